@@ -4,6 +4,7 @@
 
 int main(int argc, char *argv[]) {
     bt_Tree *tree = bt_create(cmp_data, BT_NO_DELETE);
+    bt_enable_prefix(tree, bt_prefix_str);
     bt_add(tree, "lorem ipsum");
     bt_add(tree, "lorem ipsum dolor sit amet");
     bt_add(tree, "consectetur adipiscing elit");
@@ -0,0 +1,971 @@
+#ifndef _ART_TREE_
+#define _ART_TREE_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of prefix bytes stored in an inner node.
+ * Longer compressed paths are checked optimistically against a leaf below the node.
+ */
+#define ART_MAX_PREFIX 10
+
+/**
+ * @brief Struct that defines an adaptive radix tree (ART) holding data ordered by byte string keys.
+ *
+ * Instead of comparing whole keys on every level the tree branches on single key bytes. Inner
+ * nodes grow and shrink between 4, 16, 48 and 256 children and compress paths without branches.
+ * Lookups therefore cost O(key length) independent of the number of entries.
+ * Leaves are small cells holding the data pointers, keys are extracted from the data on demand.
+ *
+ * @example Simple usage of art_Tree.
+ *   art_Tree *tree = art_create(art_key_str, ART_NO_DELETE);
+ *   art_add(tree, "lorem");
+ *   art_add(tree, "lorem ipsum");
+ *   char *found = (char *)art_find(tree, "lorem");
+ *   art_delete(tree);
+ */
+struct art_Tree {
+    /**
+     * Root node of this tree, either a tagged leaf or an inner node.
+     */
+    void *root;
+    /**
+     * Counter used for keeping track of the number of data in this tree.
+     */
+    size_t count;
+    /**
+     * Key extraction function returning the key bytes of data and writing their number to len.
+     * No two data held by the tree may have equal keys.
+     */
+    const unsigned char *(*key)(void *data, size_t *len);
+    /**
+     * Deletion function for the data.
+     */
+    void (*delete)(void *data);
+};
+
+struct art_Tree;
+typedef struct art_Tree art_Tree;
+
+void ART_TRIVIAL_DELETE(void *data);
+void ART_NO_DELETE(void *data);
+
+/**
+ * @brief Creates an empty adaptive radix tree.
+ *
+ * @param key Key extraction function returning the key bytes of data and their number in len.
+ * For zero terminated strings provide art_key_str.
+ * @param delete Deletion function used to free the data when the tree is deleted. In case you only
+ * use pointers that can be trivially freed, provide ART_TRIVIAL_DELETE. In case you do not want to
+ * delete the data, provide ART_NO_DELETE.
+ *
+ * @return pointer to the created tree or NULL if memory ran out.
+ */
+art_Tree *art_create(const unsigned char *(*key)(void *data, size_t *len),
+                     void (*delete)(void *data));
+
+/**
+ * @brief Key extraction function for zero terminated strings.
+ *
+ * @param data pointer to a zero terminated string.
+ * @param len pointer receiving the length of the string.
+ *
+ * @return pointer to the bytes of the string.
+ */
+const unsigned char *art_key_str(void *data, size_t *len);
+
+/**
+ * @brief Adds data to the tree.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ *
+ * @return true if the data was added or false if the tree already holds data with an equal key or
+ * memory ran out, in which case the tree is left unchanged.
+ */
+bool art_add(art_Tree *tree, void *data);
+
+/**
+ * @brief Removes the data with the key of data from the tree.
+ * The removed data is not deleted.
+ *
+ * @param tree pointer to a tree to remove data from.
+ * @param data pointer to data with the key to remove.
+ *
+ * @return true if data was removed or false otherwise.
+ */
+bool art_remove(art_Tree *tree, void *data);
+
+/**
+ * @brief Searches the data with the key of data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to data with the key to search for.
+ *
+ * @return pointer to the data held by the tree or NULL if there is none.
+ */
+void *art_find(art_Tree *tree, void *data);
+
+/**
+ * @brief Searches the data with the given key.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param key pointer to the key bytes.
+ * @param len number of key bytes.
+ *
+ * @return pointer to the data held by the tree or NULL if there is none.
+ */
+void *art_find_key(art_Tree *tree, const unsigned char *key, size_t len);
+
+/**
+ * @brief Writes all data of the tree ordered by key into the list pointer.
+ *
+ * @param tree pointer to a tree to traverse.
+ * @param list pointer to a list of data pointers.
+ * This list is dynamically allocated and needs to be freed by hand. It is set to NULL if memory
+ * ran out.
+ */
+void art_traverse(art_Tree *tree, void ***list);
+
+/**
+ * @brief Calls fn for all data of the tree ordered by key.
+ *
+ * @param tree pointer to a tree to walk.
+ * @param fn function called with every data and ctx. Returning anything but 0 stops the walk.
+ * @param ctx pointer passed through to fn.
+ *
+ * @return 0 if all data was visited or the value fn stopped with.
+ */
+int art_foreach(art_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx);
+
+/**
+ * @brief deletes the tree and its data using the delete function set in art_create.
+ *
+ * @param tree pointer to a tree to delete.
+ */
+void art_delete(art_Tree *tree);
+
+#endif // _ART_TREE_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _ART_TREE_IMPL_
+#define _ART_TREE_IMPL_
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum { ART_NODE4 = 1, ART_NODE16, ART_NODE48, ART_NODE256 };
+
+// header shared by all inner nodes
+typedef struct {
+    uint8_t type;
+    uint16_t num_children;
+    uint32_t prefix_len;
+    unsigned char prefix[ART_MAX_PREFIX];
+    // leaf of the data whose key ends right behind the prefix of this node
+    void *end;
+} art_Inner;
+
+typedef struct {
+    art_Inner inner;
+    unsigned char keys[4];
+    void *children[4];
+} art_Node4;
+
+typedef struct {
+    art_Inner inner;
+    unsigned char keys[16];
+    void *children[16];
+} art_Node16;
+
+typedef struct {
+    art_Inner inner;
+    // slot + 1 of the child for every key byte, 0 if there is none
+    unsigned char index[256];
+    void *children[48];
+} art_Node48;
+
+typedef struct {
+    art_Inner inner;
+    void *children[256];
+} art_Node256;
+
+// leaf holding a data pointer, data may be at any address and therefore cannot be tagged itself
+typedef struct {
+    void *data;
+} art_Leaf;
+
+// leaves are tagged in their lowest bit, inner nodes are stored untouched
+#define ART_IS_INNER(ptr) (((uintptr_t)(ptr)&1) == 0)
+#define ART_INNER(ptr) ((art_Inner *)(ptr))
+#define ART_LEAF(ptr) ((art_Leaf *)((uintptr_t)(ptr) & ~(uintptr_t)1))
+#define ART_DATA(ptr) (ART_LEAF(ptr)->data)
+
+// helper methods definition
+static art_Inner *_art_alloc(uint8_t type);
+static void *_art_leaf(void *data);
+static void *_art_free_leaf(void *leaf);
+static bool _art_equals(art_Tree *tree, void *data, const unsigned char *key, size_t len);
+static void *_art_minimum(void *node);
+static size_t _art_mismatch(art_Tree *tree, art_Inner *inner, const unsigned char *key, size_t len,
+                            size_t depth);
+static void **_art_find_child(art_Inner *inner, unsigned char byte);
+static bool _art_add_child(void **ref, art_Inner *inner, unsigned char byte, void *child);
+static void _art_remove_child(void **ref, art_Inner *inner, unsigned char byte);
+static void _art_collapse(void **ref, art_Inner *inner);
+static int _art_insert(art_Tree *tree, void **ref, void *leaf, const unsigned char *key, size_t len,
+                       size_t depth);
+static void *_art_remove(art_Tree *tree, void **ref, const unsigned char *key, size_t len,
+                         size_t depth);
+static int _art_foreach(void *node, int (*fn)(void *data, void *ctx), void *ctx);
+static int _art_collect(void *data, void *ctx);
+static void _art_delete(art_Tree *tree, void *node);
+
+art_Tree *art_create(const unsigned char *(*key)(void *data, size_t *len),
+                     void (*delete)(void *data)) {
+    art_Tree *tree = (art_Tree *)malloc(sizeof(art_Tree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->root = NULL;
+    tree->count = 0;
+    tree->key = key;
+    tree->delete = delete;
+    return tree;
+}
+
+const unsigned char *art_key_str(void *data, size_t *len) {
+    *len = strlen((const char *)data);
+    return (const unsigned char *)data;
+}
+
+bool art_add(art_Tree *tree, void *data) {
+    size_t len;
+    const unsigned char *key = tree->key(data, &len);
+    void *leaf = _art_leaf(data);
+    if (leaf == NULL) {
+        return false;
+    }
+    if (_art_insert(tree, &tree->root, leaf, key, len, 0) != 1) {
+        _art_free_leaf(leaf);
+        return false;
+    }
+    tree->count += 1;
+    return true;
+}
+
+bool art_remove(art_Tree *tree, void *data) {
+    size_t len;
+    const unsigned char *key = tree->key(data, &len);
+    if (_art_remove(tree, &tree->root, key, len, 0) == NULL) {
+        return false;
+    }
+    tree->count -= 1;
+    return true;
+}
+
+void *art_find(art_Tree *tree, void *data) {
+    size_t len;
+    const unsigned char *key = tree->key(data, &len);
+    return art_find_key(tree, key, len);
+}
+
+void *art_find_key(art_Tree *tree, const unsigned char *key, size_t len) {
+    void *node = tree->root;
+    size_t depth = 0;
+
+    while (node != NULL && ART_IS_INNER(node)) {
+        art_Inner *inner = ART_INNER(node);
+        if (inner->prefix_len > 0) {
+            // bytes beyond the stored prefix are checked against the leaf in the end
+            size_t stored = inner->prefix_len < ART_MAX_PREFIX ? inner->prefix_len : ART_MAX_PREFIX;
+            if (depth + stored > len || memcmp(inner->prefix, key + depth, stored) != 0) {
+                return NULL;
+            }
+            depth += inner->prefix_len;
+        }
+
+        if (depth >= len) {
+            node = depth == len ? inner->end : NULL;
+            break;
+        }
+
+        void **child = _art_find_child(inner, key[depth]);
+        node = child != NULL ? *child : NULL;
+        depth++;
+    }
+
+    if (node != NULL && _art_equals(tree, ART_DATA(node), key, len)) {
+        return ART_DATA(node);
+    }
+    return NULL;
+}
+
+void art_traverse(art_Tree *tree, void ***list) {
+    *list = (void **)malloc(tree->count * sizeof(void *));
+    if (*list == NULL) {
+        return;
+    }
+    void **cursor = *list;
+    _art_foreach(tree->root, _art_collect, &cursor);
+}
+
+int art_foreach(art_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx) {
+    return _art_foreach(tree->root, fn, ctx);
+}
+
+void art_delete(art_Tree *tree) {
+    _art_delete(tree, tree->root);
+    free(tree);
+}
+
+void ART_TRIVIAL_DELETE(void *data) { free(data); }
+void ART_NO_DELETE(void *data) { (void)data; }
+// helper methods implementation
+
+static art_Inner *_art_alloc(uint8_t type) {
+    size_t size;
+    switch (type) {
+    case ART_NODE4:
+        size = sizeof(art_Node4);
+        break;
+    case ART_NODE16:
+        size = sizeof(art_Node16);
+        break;
+    case ART_NODE48:
+        size = sizeof(art_Node48);
+        break;
+    default:
+        size = sizeof(art_Node256);
+        break;
+    }
+
+    art_Inner *inner = (art_Inner *)calloc(1, size);
+    if (inner == NULL) {
+        return NULL;
+    }
+    inner->type = type;
+    return inner;
+}
+
+// wraps data into a tagged leaf, NULL if memory ran out
+static void *_art_leaf(void *data) {
+    art_Leaf *leaf = (art_Leaf *)malloc(sizeof(art_Leaf));
+    if (leaf == NULL) {
+        return NULL;
+    }
+    leaf->data = data;
+    return (void *)((uintptr_t)leaf | 1);
+}
+
+// frees a tagged leaf and returns its data
+static void *_art_free_leaf(void *leaf) {
+    void *data = ART_DATA(leaf);
+    free(ART_LEAF(leaf));
+    return data;
+}
+
+static bool _art_equals(art_Tree *tree, void *data, const unsigned char *key, size_t len) {
+    size_t data_len;
+    const unsigned char *data_key = tree->key(data, &data_len);
+    return data_len == len && memcmp(data_key, key, len) == 0;
+}
+
+// the data with the smallest key below node
+static void *_art_minimum(void *node) {
+    while (ART_IS_INNER(node)) {
+        art_Inner *inner = ART_INNER(node);
+        if (inner->end != NULL) {
+            return ART_DATA(inner->end);
+        }
+
+        int idx = 0;
+        switch (inner->type) {
+        case ART_NODE4:
+            node = ((art_Node4 *)inner)->children[0];
+            break;
+        case ART_NODE16:
+            node = ((art_Node16 *)inner)->children[0];
+            break;
+        case ART_NODE48:
+            while (((art_Node48 *)inner)->index[idx] == 0) {
+                idx++;
+            }
+            node = ((art_Node48 *)inner)->children[((art_Node48 *)inner)->index[idx] - 1];
+            break;
+        default:
+            while (((art_Node256 *)inner)->children[idx] == NULL) {
+                idx++;
+            }
+            node = ((art_Node256 *)inner)->children[idx];
+            break;
+        }
+    }
+    return ART_DATA(node);
+}
+
+// number of leading prefix bytes of inner matching key at depth
+static size_t _art_mismatch(art_Tree *tree, art_Inner *inner, const unsigned char *key, size_t len,
+                            size_t depth) {
+    size_t remaining = len - depth;
+    size_t max_cmp = inner->prefix_len < ART_MAX_PREFIX ? inner->prefix_len : ART_MAX_PREFIX;
+    if (max_cmp > remaining) {
+        max_cmp = remaining;
+    }
+
+    size_t idx;
+    for (idx = 0; idx < max_cmp; idx++) {
+        if (inner->prefix[idx] != key[depth + idx]) {
+            return idx;
+        }
+    }
+
+    if (inner->prefix_len > ART_MAX_PREFIX) {
+        size_t leaf_len;
+        const unsigned char *leaf_key = tree->key(_art_minimum(inner), &leaf_len);
+        max_cmp = (leaf_len < len ? leaf_len : len) - depth;
+        if (max_cmp > inner->prefix_len) {
+            max_cmp = inner->prefix_len;
+        }
+        for (; idx < max_cmp; idx++) {
+            if (leaf_key[depth + idx] != key[depth + idx]) {
+                return idx;
+            }
+        }
+    }
+    return idx;
+}
+
+#if defined(__SSE2__)
+static int _art_lowest_bit(int mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz((unsigned int)mask);
+#else
+    int idx = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+#endif
+
+static void **_art_find_child(art_Inner *inner, unsigned char byte) {
+    int idx;
+    switch (inner->type) {
+    case ART_NODE4: {
+        art_Node4 *node = (art_Node4 *)inner;
+        for (idx = 0; idx < node->inner.num_children; idx++) {
+            if (node->keys[idx] == byte) {
+                return &node->children[idx];
+            }
+        }
+        return NULL;
+    }
+    case ART_NODE16: {
+        art_Node16 *node = (art_Node16 *)inner;
+#if defined(__SSE2__)
+        // compares all 16 keys at once
+        __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)byte),
+                                     _mm_loadu_si128((const __m128i *)node->keys));
+        int mask = _mm_movemask_epi8(cmp) & ((1 << node->inner.num_children) - 1);
+        if (mask != 0) {
+            return &node->children[_art_lowest_bit(mask)];
+        }
+#else
+        for (idx = 0; idx < node->inner.num_children; idx++) {
+            if (node->keys[idx] == byte) {
+                return &node->children[idx];
+            }
+        }
+#endif
+        return NULL;
+    }
+    case ART_NODE48: {
+        art_Node48 *node = (art_Node48 *)inner;
+        if (node->index[byte] == 0) {
+            return NULL;
+        }
+        return &node->children[node->index[byte] - 1];
+    }
+    default: {
+        art_Node256 *node = (art_Node256 *)inner;
+        if (node->children[byte] == NULL) {
+            return NULL;
+        }
+        return &node->children[byte];
+    }
+    }
+}
+
+// adds child below byte, growing inner into the next node size if it is full, false if memory ran
+// out while growing, in which case inner is left unchanged
+static bool _art_add_child(void **ref, art_Inner *inner, unsigned char byte, void *child) {
+    int idx;
+    switch (inner->type) {
+    case ART_NODE4: {
+        art_Node4 *node = (art_Node4 *)inner;
+        if (node->inner.num_children < 4) {
+            for (idx = 0; idx < node->inner.num_children && node->keys[idx] < byte; idx++) {
+            }
+            memmove(node->keys + idx + 1, node->keys + idx, node->inner.num_children - idx);
+            memmove(node->children + idx + 1, node->children + idx,
+                    (node->inner.num_children - idx) * sizeof(void *));
+            node->keys[idx] = byte;
+            node->children[idx] = child;
+            node->inner.num_children++;
+            return true;
+        }
+
+        art_Node16 *grown = (art_Node16 *)_art_alloc(ART_NODE16);
+        if (grown == NULL) {
+            return false;
+        }
+        grown->inner = node->inner;
+        grown->inner.type = ART_NODE16;
+        memcpy(grown->keys, node->keys, sizeof(node->keys));
+        memcpy(grown->children, node->children, sizeof(node->children));
+        *ref = grown;
+        free(node);
+        return _art_add_child(ref, &grown->inner, byte, child);
+    }
+    case ART_NODE16: {
+        art_Node16 *node = (art_Node16 *)inner;
+        if (node->inner.num_children < 16) {
+            for (idx = 0; idx < node->inner.num_children && node->keys[idx] < byte; idx++) {
+            }
+            memmove(node->keys + idx + 1, node->keys + idx, node->inner.num_children - idx);
+            memmove(node->children + idx + 1, node->children + idx,
+                    (node->inner.num_children - idx) * sizeof(void *));
+            node->keys[idx] = byte;
+            node->children[idx] = child;
+            node->inner.num_children++;
+            return true;
+        }
+
+        art_Node48 *grown = (art_Node48 *)_art_alloc(ART_NODE48);
+        if (grown == NULL) {
+            return false;
+        }
+        grown->inner = node->inner;
+        grown->inner.type = ART_NODE48;
+        for (idx = 0; idx < 16; idx++) {
+            grown->index[node->keys[idx]] = (unsigned char)(idx + 1);
+            grown->children[idx] = node->children[idx];
+        }
+        *ref = grown;
+        free(node);
+        return _art_add_child(ref, &grown->inner, byte, child);
+    }
+    case ART_NODE48: {
+        art_Node48 *node = (art_Node48 *)inner;
+        if (node->inner.num_children < 48) {
+            for (idx = 0; node->children[idx] != NULL; idx++) {
+            }
+            node->children[idx] = child;
+            node->index[byte] = (unsigned char)(idx + 1);
+            node->inner.num_children++;
+            return true;
+        }
+
+        art_Node256 *grown = (art_Node256 *)_art_alloc(ART_NODE256);
+        if (grown == NULL) {
+            return false;
+        }
+        grown->inner = node->inner;
+        grown->inner.type = ART_NODE256;
+        for (idx = 0; idx < 256; idx++) {
+            if (node->index[idx] != 0) {
+                grown->children[idx] = node->children[node->index[idx] - 1];
+            }
+        }
+        *ref = grown;
+        free(node);
+        return _art_add_child(ref, &grown->inner, byte, child);
+    }
+    default: {
+        art_Node256 *node = (art_Node256 *)inner;
+        node->children[byte] = child;
+        node->inner.num_children++;
+        return true;
+    }
+    }
+}
+
+// removes the child below byte, shrinking inner into the previous node size if it gets sparse and
+// keeping the larger node if memory ran out
+static void _art_remove_child(void **ref, art_Inner *inner, unsigned char byte) {
+    int idx;
+    int pos;
+    switch (inner->type) {
+    case ART_NODE4: {
+        art_Node4 *node = (art_Node4 *)inner;
+        for (idx = 0; node->keys[idx] != byte; idx++) {
+        }
+        memmove(node->keys + idx, node->keys + idx + 1, node->inner.num_children - idx - 1);
+        memmove(node->children + idx, node->children + idx + 1,
+                (node->inner.num_children - idx - 1) * sizeof(void *));
+        node->inner.num_children--;
+        _art_collapse(ref, inner);
+        return;
+    }
+    case ART_NODE16: {
+        art_Node16 *node = (art_Node16 *)inner;
+        for (idx = 0; node->keys[idx] != byte; idx++) {
+        }
+        memmove(node->keys + idx, node->keys + idx + 1, node->inner.num_children - idx - 1);
+        memmove(node->children + idx, node->children + idx + 1,
+                (node->inner.num_children - idx - 1) * sizeof(void *));
+        node->inner.num_children--;
+        if (node->inner.num_children > 3) {
+            return;
+        }
+
+        art_Node4 *shrunk = (art_Node4 *)_art_alloc(ART_NODE4);
+        if (shrunk == NULL) {
+            return;
+        }
+        shrunk->inner = node->inner;
+        shrunk->inner.type = ART_NODE4;
+        memcpy(shrunk->keys, node->keys, 3);
+        memcpy(shrunk->children, node->children, 3 * sizeof(void *));
+        *ref = shrunk;
+        free(node);
+        return;
+    }
+    case ART_NODE48: {
+        art_Node48 *node = (art_Node48 *)inner;
+        node->children[node->index[byte] - 1] = NULL;
+        node->index[byte] = 0;
+        node->inner.num_children--;
+        if (node->inner.num_children > 12) {
+            return;
+        }
+
+        art_Node16 *shrunk = (art_Node16 *)_art_alloc(ART_NODE16);
+        if (shrunk == NULL) {
+            return;
+        }
+        shrunk->inner = node->inner;
+        shrunk->inner.type = ART_NODE16;
+        for (idx = 0, pos = 0; idx < 256; idx++) {
+            if (node->index[idx] != 0) {
+                shrunk->keys[pos] = (unsigned char)idx;
+                shrunk->children[pos++] = node->children[node->index[idx] - 1];
+            }
+        }
+        *ref = shrunk;
+        free(node);
+        return;
+    }
+    default: {
+        art_Node256 *node = (art_Node256 *)inner;
+        node->children[byte] = NULL;
+        node->inner.num_children--;
+        if (node->inner.num_children > 37) {
+            return;
+        }
+
+        art_Node48 *shrunk = (art_Node48 *)_art_alloc(ART_NODE48);
+        if (shrunk == NULL) {
+            return;
+        }
+        shrunk->inner = node->inner;
+        shrunk->inner.type = ART_NODE48;
+        for (idx = 0, pos = 0; idx < 256; idx++) {
+            if (node->children[idx] != NULL) {
+                shrunk->children[pos] = node->children[idx];
+                shrunk->index[idx] = (unsigned char)(++pos);
+            }
+        }
+        *ref = shrunk;
+        free(node);
+        return;
+    }
+    }
+}
+
+// replaces a Node4 that no longer branches by its only entry, merging the compressed paths
+static void _art_collapse(void **ref, art_Inner *inner) {
+    art_Node4 *node = (art_Node4 *)inner;
+    if (inner->type != ART_NODE4) {
+        return;
+    }
+
+    if (inner->num_children == 0) {
+        *ref = inner->end;
+        free(node);
+        return;
+    }
+    if (inner->num_children > 1 || inner->end != NULL) {
+        return;
+    }
+
+    void *child = node->children[0];
+    if (ART_IS_INNER(child)) {
+        art_Inner *below = ART_INNER(child);
+        unsigned char prefix[ART_MAX_PREFIX];
+        size_t len = inner->prefix_len < ART_MAX_PREFIX ? inner->prefix_len : ART_MAX_PREFIX;
+        memcpy(prefix, inner->prefix, len);
+        if (len < ART_MAX_PREFIX) {
+            prefix[len++] = node->keys[0];
+        }
+        size_t below_len = below->prefix_len < ART_MAX_PREFIX ? below->prefix_len : ART_MAX_PREFIX;
+        if (below_len > ART_MAX_PREFIX - len) {
+            below_len = ART_MAX_PREFIX - len;
+        }
+        memcpy(prefix + len, below->prefix, below_len);
+        memcpy(below->prefix, prefix, len + below_len);
+        below->prefix_len += inner->prefix_len + 1;
+    }
+    *ref = child;
+    free(node);
+}
+
+// inserts leaf below ref, 1 if added, 0 if the key exists and -1 if memory ran out, in which case
+// the tree is left unchanged
+static int _art_insert(art_Tree *tree, void **ref, void *leaf, const unsigned char *key, size_t len,
+                       size_t depth) {
+    void *node = *ref;
+    if (node == NULL) {
+        *ref = leaf;
+        return 1;
+    }
+
+    if (!ART_IS_INNER(node)) {
+        size_t other_len;
+        const unsigned char *other_key = tree->key(ART_DATA(node), &other_len);
+        if (other_len == len && memcmp(other_key, key, len) == 0) {
+            return 0;
+        }
+
+        // both keys share the path up to depth, branch where they differ
+        size_t limit = (other_len < len ? other_len : len) - depth;
+        size_t common = 0;
+        while (common < limit && other_key[depth + common] == key[depth + common]) {
+            common++;
+        }
+
+        art_Inner *split = _art_alloc(ART_NODE4);
+        if (split == NULL) {
+            return -1;
+        }
+        void *branch = split;
+        split->prefix_len = (uint32_t)common;
+        memcpy(split->prefix, key + depth, common < ART_MAX_PREFIX ? common : ART_MAX_PREFIX);
+        depth += common;
+
+        if (other_len == depth) {
+            split->end = node;
+        } else {
+            _art_add_child(&branch, split, other_key[depth], node);
+        }
+        if (len == depth) {
+            split->end = leaf;
+        } else {
+            _art_add_child(&branch, split, key[depth], leaf);
+        }
+        *ref = branch;
+        return 1;
+    }
+
+    art_Inner *inner = ART_INNER(node);
+    if (inner->prefix_len > 0) {
+        size_t matched = _art_mismatch(tree, inner, key, len, depth);
+        if (matched < inner->prefix_len) {
+            // the key leaves the compressed path, branch in the middle of it
+            art_Inner *split = _art_alloc(ART_NODE4);
+            if (split == NULL) {
+                return -1;
+            }
+            void *branch = split;
+            split->prefix_len = (uint32_t)matched;
+            memcpy(split->prefix, inner->prefix,
+                   matched < ART_MAX_PREFIX ? matched : ART_MAX_PREFIX);
+
+            if (inner->prefix_len <= ART_MAX_PREFIX) {
+                _art_add_child(&branch, split, inner->prefix[matched], node);
+                inner->prefix_len -= (uint32_t)(matched + 1);
+                memmove(inner->prefix, inner->prefix + matched + 1, inner->prefix_len);
+            } else {
+                size_t leaf_len;
+                const unsigned char *leaf_key = tree->key(_art_minimum(node), &leaf_len);
+                _art_add_child(&branch, split, leaf_key[depth + matched], node);
+                inner->prefix_len -= (uint32_t)(matched + 1);
+                memcpy(inner->prefix, leaf_key + depth + matched + 1,
+                       inner->prefix_len < ART_MAX_PREFIX ? inner->prefix_len : ART_MAX_PREFIX);
+            }
+
+            if (len == depth + matched) {
+                split->end = leaf;
+            } else {
+                _art_add_child(&branch, split, key[depth + matched], leaf);
+            }
+            *ref = branch;
+            return 1;
+        }
+        depth += inner->prefix_len;
+    }
+
+    if (depth == len) {
+        if (inner->end != NULL) {
+            return 0;
+        }
+        inner->end = leaf;
+        return 1;
+    }
+
+    void **child = _art_find_child(inner, key[depth]);
+    if (child != NULL) {
+        return _art_insert(tree, child, leaf, key, len, depth + 1);
+    }
+
+    return _art_add_child(ref, inner, key[depth], leaf) ? 1 : -1;
+}
+
+static void *_art_remove(art_Tree *tree, void **ref, const unsigned char *key, size_t len,
+                         size_t depth) {
+    void *node = *ref;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (!ART_IS_INNER(node)) {
+        if (!_art_equals(tree, ART_DATA(node), key, len)) {
+            return NULL;
+        }
+        *ref = NULL;
+        return _art_free_leaf(node);
+    }
+
+    art_Inner *inner = ART_INNER(node);
+    if (inner->prefix_len > 0) {
+        size_t stored = inner->prefix_len < ART_MAX_PREFIX ? inner->prefix_len : ART_MAX_PREFIX;
+        if (depth + stored > len || memcmp(inner->prefix, key + depth, stored) != 0) {
+            return NULL;
+        }
+        depth += inner->prefix_len;
+    }
+
+    if (depth >= len) {
+        void *end = inner->end;
+        if (depth > len || end == NULL || !_art_equals(tree, ART_DATA(end), key, len)) {
+            return NULL;
+        }
+        inner->end = NULL;
+        _art_collapse(ref, inner);
+        return _art_free_leaf(end);
+    }
+
+    void **child = _art_find_child(inner, key[depth]);
+    if (child == NULL) {
+        return NULL;
+    }
+
+    if (ART_IS_INNER(*child)) {
+        return _art_remove(tree, child, key, len, depth + 1);
+    }
+
+    void *leaf = *child;
+    if (!_art_equals(tree, ART_DATA(leaf), key, len)) {
+        return NULL;
+    }
+    _art_remove_child(ref, inner, key[depth]);
+    return _art_free_leaf(leaf);
+}
+
+static int _art_foreach(void *node, int (*fn)(void *data, void *ctx), void *ctx) {
+    if (node == NULL) {
+        return 0;
+    }
+    if (!ART_IS_INNER(node)) {
+        return fn(ART_DATA(node), ctx);
+    }
+
+    art_Inner *inner = ART_INNER(node);
+    int stop = 0;
+    int idx;
+
+    // a key ending here is a prefix of all keys below and therefore comes first
+    if (inner->end != NULL) {
+        stop = fn(ART_DATA(inner->end), ctx);
+    }
+
+    switch (inner->type) {
+    case ART_NODE4:
+        for (idx = 0; stop == 0 && idx < inner->num_children; idx++) {
+            stop = _art_foreach(((art_Node4 *)inner)->children[idx], fn, ctx);
+        }
+        break;
+    case ART_NODE16:
+        for (idx = 0; stop == 0 && idx < inner->num_children; idx++) {
+            stop = _art_foreach(((art_Node16 *)inner)->children[idx], fn, ctx);
+        }
+        break;
+    case ART_NODE48:
+        for (idx = 0; stop == 0 && idx < 256; idx++) {
+            art_Node48 *node48 = (art_Node48 *)inner;
+            if (node48->index[idx] != 0) {
+                stop = _art_foreach(node48->children[node48->index[idx] - 1], fn, ctx);
+            }
+        }
+        break;
+    default:
+        for (idx = 0; stop == 0 && idx < 256; idx++) {
+            stop = _art_foreach(((art_Node256 *)inner)->children[idx], fn, ctx);
+        }
+        break;
+    }
+    return stop;
+}
+
+static int _art_collect(void *data, void *ctx) {
+    void ***cursor = (void ***)ctx;
+    *(*cursor)++ = data;
+    return 0;
+}
+
+static void _art_delete(art_Tree *tree, void *node) {
+    if (node == NULL) {
+        return;
+    }
+    if (!ART_IS_INNER(node)) {
+        tree->delete (_art_free_leaf(node));
+        return;
+    }
+
+    art_Inner *inner = ART_INNER(node);
+    int idx;
+    _art_delete(tree, inner->end);
+    switch (inner->type) {
+    case ART_NODE4:
+        for (idx = 0; idx < inner->num_children; idx++) {
+            _art_delete(tree, ((art_Node4 *)inner)->children[idx]);
+        }
+        break;
+    case ART_NODE16:
+        for (idx = 0; idx < inner->num_children; idx++) {
+            _art_delete(tree, ((art_Node16 *)inner)->children[idx]);
+        }
+        break;
+    case ART_NODE48:
+        for (idx = 0; idx < 48; idx++) {
+            _art_delete(tree, ((art_Node48 *)inner)->children[idx]);
+        }
+        break;
+    default:
+        for (idx = 0; idx < 256; idx++) {
+            _art_delete(tree, ((art_Node256 *)inner)->children[idx]);
+        }
+        break;
+    }
+    free(inner);
+}
+#endif // _ART_TREE_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
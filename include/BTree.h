@@ -3,11 +3,14 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define bt_max(x, y) (x > y ? x : y)
 
 /**
  * @brief Struct that defines a node in the binary tree.
+ * Fields only some modes need are stored behind the node, so nodes of plain trees stay small.
+ * @see bt_Tree::layout
  */
 struct bt_Node {
     /**
@@ -18,16 +21,70 @@ struct bt_Node {
      * @brief Pointer to the right child of this node (NULL if empty).
      */
     struct bt_Node *right;
+    /**
+     * @brief Pointer to the parent of this node (NULL for the root).
+     */
+    struct bt_Node *parent;
+    /**
+     * @brief Number of nodes in the subtree rooted at this node (including itself).
+     */
+    size_t size;
+    /**
+     * @brief Height of the subtree rooted at this node (1 for a leaf).
+     */
+    unsigned int height : 30;
+    /**
+     * @brief Set if a node within the subtree rooted at this node has children whose heights
+     * differ by more than one, i.e. bt_balance_step has work left there.
+     */
+    unsigned int dirty : 1;
+    /**
+     * @brief Set if bt_compact placed this node in a region instead of allocating it alone.
+     */
+    unsigned int compacted : 1;
+    /**
+     * @brief Number of times the data was added to a multiset tree (1 otherwise).
+     */
+    unsigned int multiplicity;
     /**
      * @brief pointer to the data held by this node.
      * This pointer is used for the compare, delete and to_str method of the binary
      * tree.
+     * For trees with inline keys it points behind this node where the key bytes are stored
+     * (as the last field behind it).
      */
     void *data;
 };
 
 struct bt_Node;
 typedef struct bt_Node bt_Node;
+struct bt_Region;
+
+/**
+ * @brief Strategies used to keep a tree balanced.
+ */
+typedef enum {
+    // every add and remove balances the tree
+    EAGER_BALANCE,
+    // adds and removes leave the tree as it is, bt_balance_step balances it later
+    DEFERRED_BALANCE,
+    // adds that end up too deep for count rebuild the subtree of a scapegoat ancestor
+    SCAPEGOAT_BALANCE,
+    // nodes get random priorities and are kept in heap order by them
+    TREAP_BALANCE
+} BalanceStrategy;
+
+/**
+ * @brief Results of the operations that tell why they failed.
+ */
+typedef enum {
+    // the operation succeeded
+    BT_OK,
+    // the tree already holds equal data
+    BT_EXISTS,
+    // memory ran out, the tree is left as it was
+    BT_ENOMEM
+} bt_Status;
 
 /**
  * @brief Struct that defines the binary tree and holds necessary methods for node handling.
@@ -66,6 +123,122 @@ struct bt_Tree {
      * Deletion function for a node's data.
      */
     void (*delete)(void *data);
+    /**
+     * Multiset mode, set it before the first add.
+     * Adding equal data again increments the multiplicity of its node instead of failing and
+     * removing it decrements the multiplicity until the node is removed.
+     * count keeps counting nodes, i.e. distinct data.
+     */
+    bool multiset;
+    /**
+     * Map mode set by bt_create_map.
+     * Nodes hold a value next to their key (data) and the delete function is used for values.
+     */
+    bool map;
+    /**
+     * Fields stored behind every node, fixed by the modes enabled while the tree holds no nodes.
+     * In this order: the value of a map, the aggregate, the greatest high endpoint within the
+     * subtree of an interval tree, the normalized prefix, the treap priority and the inline key.
+     */
+    uint8_t layout;
+    /**
+     * Size of the keys in bytes if they are stored inline in the nodes or 0 if data is a pointer
+     * owned by the caller. Inline keys are copied on add, are never passed to delete and save the
+     * caller one allocation and the tree one indirection per compare.
+     */
+    size_t key_size;
+    /**
+     * Interval mode set by bt_enable_interval.
+     * Returns the low and high endpoint of the interval stored in data.
+     */
+    void *(*low)(void *data);
+    void *(*high)(void *data);
+    /**
+     * Comparison function for two interval endpoints, same contract as compare.
+     */
+    int (*compare_point)(void *p1, void *p2);
+    /**
+     * Aggregate mode set by bt_enable_aggregate.
+     * Every node stores aggregate_size bytes right behind itself holding the aggregate of its
+     * subtree (@see bt_node_aggregate), padded in the node to keep the fields behind it aligned.
+     */
+    size_t aggregate_size;
+    void (*lift)(bt_Node *node, void *out);
+    void (*combine)(void *out, const void *a, const void *b);
+    const void *identity;
+    /**
+     * Prefix mode set by bt_enable_prefix.
+     * Maps data to an integer which orders like the data as far as it goes, i.e.
+     * normalize(d1) < normalize(d2) has to imply d1 < d2.
+     */
+    uint64_t (*normalize)(void *data);
+    /**
+     * Filter mode set by bt_enable_filter.
+     * Counting bloom filter of filter_size counters over the data of all nodes, letting lookups of
+     * absent data return without a single compare.
+     */
+    uint64_t (*hash)(void *data);
+    uint8_t *filter;
+    size_t filter_size;
+    /**
+     * Balance strategy, EAGER_BALANCE by default. It can be changed at any time, a tree left
+     * unbalanced by DEFERRED_BALANCE is balanced by the next eager add or remove. Only
+     * TREAP_BALANCE has to be set before the first add, nodes added before have no priority.
+     */
+    BalanceStrategy balance;
+    /**
+     * Finger mode for nearly sorted input, set it at any time. Adds search from finger_node, the
+     * node the last add ended at, instead of from the root, which takes O(log d) compares for data
+     * d nodes away from it.
+     */
+    bool finger;
+    /**
+     * Node bt_balance_step continues its walk from, NULL to start at the root.
+     */
+    bt_Node *balance_cursor;
+    /**
+     * Greatest count since the last rebuild of the whole tree by SCAPEGOAT_BALANCE, removes rebuild
+     * it once count falls below two thirds of it.
+     */
+    size_t max_count;
+    /**
+     * State of the generator drawing the priorities of TREAP_BALANCE, assign it to seed the
+     * generator.
+     */
+    uint64_t rng;
+    /**
+     * Allocator of the nodes set by bt_set_allocator, node_alloc is NULL for malloc and free.
+     */
+    void *(*node_alloc)(size_t size, void *ctx);
+    void (*node_free)(void *node, void *ctx);
+    void *allocator;
+    /**
+     * State of bt_compact_step, the next node to relocate and the region nodes are relocated to.
+     */
+    bt_Node *compact_cursor;
+    struct bt_Region *compact_region;
+    /**
+     * Nodes allocated ahead by bt_reserve and linked through their right child, adds take them
+     * before allocating.
+     */
+    bt_Node *reserve;
+    size_t reserved;
+    /**
+     * Small mode, set small_max before the first add. Up to small_max nodes are kept sorted in one
+     * block, which takes one allocation instead of one per node and keeps the nodes next to each
+     * other. The nodes move into allocations of their own once the tree grows beyond small_max and
+     * back into a block once removes shrink it to half of small_max. In a block adds and removes
+     * move the nodes, so pointers to nodes are only valid until the next change. The block is
+     * allocated like the nodes. Not used by treaps, by trees holding reserved nodes and by
+     * allocators that cannot hand out small_max nodes at once, e.g. arenas.
+     */
+    size_t small_max;
+    bt_Node *small;
+    /**
+     * Node the last add ended at in finger mode, NULL until the first add and after changes that
+     * free or move it.
+     */
+    bt_Node *finger_node;
 };
 
 struct bt_Tree;
@@ -97,7 +270,7 @@ void BT_NO_DELETE(void *data);
  * case you only use pointers that can be trivially freed, provide BT_TRIVIAL_DELETE. In case you do
  * not want to delete the data, provide BT_NO_DELETE.
  *
- * @return pointer to the created tree.
+ * @return pointer to the created tree or NULL if memory ran out.
  */
 bt_Tree *bt_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data));
 
@@ -123,6 +296,19 @@ bt_Tree *bt_create_int(void (*delete)(void *data));
  */
 bt_Tree *bt_create_float(void (*delete)(void *data));
 
+/**
+ * @brief Creates an empty map which holds a value for every key.
+ *
+ * @param compare Comparison function used to order and compare of two keys.
+ * @param key_size Size of a key in bytes. Keys are copied into the nodes. Provide 0 to store the key
+ * pointers instead, in this case the keys stay owned by the caller.
+ * @param delete Deletion function used to free the values when the tree is deleted.
+ *
+ * @return pointer to the created tree.
+ */
+bt_Tree *bt_create_map(int (*compare)(void *d1, void *d2), size_t key_size,
+                       void (*delete)(void *value));
+
 /**
  * @brief Adds a new node holding data to the tree.
  *
@@ -132,6 +318,92 @@ bt_Tree *bt_create_float(void (*delete)(void *data));
  * @return true if the data was added or false otherwise.
  */
 bool bt_add(bt_Tree *tree, void *data);
+/**
+ * @brief Adds a new node holding data to the tree and tells why it failed.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ *
+ * @return BT_OK if the data was added, BT_EXISTS if the tree holds equal data and is no multiset
+ * or BT_ENOMEM if no node could be allocated.
+ */
+bt_Status bt_try_add(bt_Tree *tree, void *data);
+/**
+ * @brief Adds a new node holding data to the tree unless it holds equal data and hands out the
+ * node holding the data either way, both in a single descent. Multisets do not count equal data
+ * again.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ * @param node set to the added node or the node holding equal data, NULL if memory ran out. In
+ * small mode it is only valid until the next change of the tree.
+ *
+ * @return BT_OK if the data was added, BT_EXISTS if the tree holds equal data or BT_ENOMEM if no
+ * node could be allocated.
+ */
+bt_Status bt_upsert(bt_Tree *tree, void *data, bt_Node **node);
+/**
+ * @brief Allocates nodes ahead, so the next n adds to tree do not allocate memory.
+ * The nodes are kept until they are used or the tree is deleted. Reserve after
+ * bt_set_allocator, setting an allocator frees the reserved nodes. A tree in small mode moves its
+ * nodes out of the block first and opens no block while it holds reserved nodes.
+ *
+ * @param tree pointer to a tree to reserve nodes for.
+ * @param n number of nodes that have to be reserved.
+ *
+ * @return BT_OK if n nodes are reserved or BT_ENOMEM if memory ran out before, the nodes
+ * allocated so far stay reserved.
+ */
+bt_Status bt_reserve(bt_Tree *tree, size_t n);
+/**
+ * @brief Adds data to the tree or merges it into the node holding equal data.
+ * Both cases are handled in a single descent.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ * @param merge function called with the data already held by the tree and data in case the tree
+ * already holds equal data. Its result replaces the node's data and has to compare equal to data.
+ * This allows e.g. to chain values of equal keys. For inline keys the result is copied into the
+ * node.
+ *
+ * @return true if a new node was added or false if data was merged or memory ran out.
+ */
+bool bt_add_or_update(bt_Tree *tree, void *data, void *(*merge)(void *existing, void *data));
+
+/**
+ * @brief Sets the value of key in a map, adding the key if needed.
+ *
+ * @param tree pointer to a map created by bt_create_map.
+ * @param key pointer to the key.
+ * @param value pointer to the value to store.
+ * @param old pointer receiving the replaced value or NULL if the key was new. May be NULL if the
+ * replaced value is of no interest, it is not deleted by the tree. If memory ran out it receives
+ * value, which was not stored.
+ *
+ * @return true if the key was added or false if its value was replaced.
+ */
+bool bt_put(bt_Tree *tree, void *key, void *value, void **old);
+
+/**
+ * @brief Looks up the value of key in a map.
+ *
+ * @param tree pointer to a map created by bt_create_map.
+ * @param key pointer to the key.
+ *
+ * @return the value stored for key or NULL if the key is not part of the map.
+ */
+void *bt_get(bt_Tree *tree, void *key);
+
+/**
+ * @brief Counts how often data was added to the tree.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to search for.
+ *
+ * @return multiplicity of data (always 0 or 1 if the tree is no multiset).
+ */
+size_t bt_multiplicity(bt_Tree *tree, void *data);
+
 /**
  * @brief Removes the node holding data from the tree.
  *
@@ -142,6 +414,94 @@ bool bt_add(bt_Tree *tree, void *data);
  */
 bool bt_remove(bt_Tree *tree, void *data);
 
+/**
+ * @brief Removes the given node from the tree.
+ * The node is unlinked and freed regardless of its multiplicity, its data is left untouched.
+ *
+ * @param tree pointer to a tree that holds node.
+ * @param node pointer to a node of tree, e.g. returned by bt_find.
+ *
+ * @return true if the node was removed or false otherwise.
+ */
+bool bt_remove_node(bt_Tree *tree, bt_Node *node);
+
+/**
+ * @brief Searches the node holding data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to search for.
+ *
+ * @return pointer to the node holding data or NULL if there is none. In small mode adds and
+ * removes move the nodes, so the pointer is only valid until the next change of the tree.
+ */
+bt_Node *bt_find(bt_Tree *tree, void *data);
+
+/**
+ * @brief Searches the first node whose data is not less than data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to compare against.
+ *
+ * @return pointer to the found node or NULL if all nodes are less than data. Valid until the
+ * next change of the tree in small mode.
+ */
+bt_Node *bt_lower_bound(bt_Tree *tree, void *data);
+
+/**
+ * @brief Searches the first node whose data is greater than data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to compare against.
+ *
+ * @return pointer to the found node or NULL if no node is greater than data. Valid until the
+ * next change of the tree in small mode.
+ */
+bt_Node *bt_upper_bound(bt_Tree *tree, void *data);
+
+/**
+ * @brief Returns the node holding the smallest data of the tree.
+ *
+ * @param tree pointer to a tree.
+ *
+ * @return pointer to the first node or NULL if the tree is empty. Valid until the next change of
+ * the tree in small mode.
+ */
+bt_Node *bt_first(bt_Tree *tree);
+
+/**
+ * @brief Returns the node holding the greatest data of the tree.
+ *
+ * @param tree pointer to a tree.
+ *
+ * @return pointer to the last node or NULL if the tree is empty. Valid until the next change of
+ * the tree in small mode.
+ */
+bt_Node *bt_last(bt_Tree *tree);
+
+/**
+ * @brief Steps to the in-order successor of node using the parent links.
+ *
+ * @example Walking a tree in sorted order without bt_traverse.
+ *   bt_Node *node;
+ *   for (node = bt_first(tree); node != NULL; node = bt_next(node)) {
+ *       printf("%d, ", *(int *)node->data);
+ *   }
+ *
+ * @param node pointer to a node of a tree.
+ *
+ * @return pointer to the next greater node or NULL if node is the last one.
+ */
+bt_Node *bt_next(bt_Node *node);
+
+/**
+ * @brief Steps to the in-order predecessor of node using the parent links.
+ *
+ * @param node pointer to a node of a tree.
+ *
+ * @return pointer to the next smaller node or NULL if node is the first one.
+ */
+bt_Node *bt_prev(bt_Node *node);
+
 /**
  * @brief Traverses tree according to strategy used and writes the result in the list pointer.
  *
@@ -150,6 +510,8 @@ bool bt_remove(bt_Tree *tree, void *data);
  * @param list pointer to a list of node pointers.
  * This list is dynamically allocated and needs to be freed by hand.
  *
+ * @return BT_OK or BT_ENOMEM if the list could not be allocated.
+ *
  * @example Simple but complete usage of bt_traverse.
  *   bt_Tree *tree = bt_create_int(BT_NO_DELETE);
  *   int val1 = 3;
@@ -168,221 +530,2028 @@ bool bt_remove(bt_Tree *tree, void *data);
  *   free(list);
  *   bt_delte(tree);
  */
-void bt_traverse(bt_Tree *tree, TraversalStrategy strategy, bt_Node ***list);
+bt_Status bt_traverse(bt_Tree *tree, TraversalStrategy strategy, bt_Node ***list);
 
 /**
- * @brief Tests if tree is completely balanced.
- * This required all nodes in the tree to be balanced.
+ * @brief Returns the node a traversal according to strategy starts with.
  *
- * @param tree pointer to a tree to check for balance.
+ * @param tree pointer to a tree to traverse.
+ * @param strategy strategy to use (@see TraversalStrategy)
  *
- * @return true if tree is balanced or false otherwise.
+ * @return pointer to the first node or NULL if the tree is empty. Valid until the next change of
+ * the tree in small mode.
  */
-bool bt_is_balanced(bt_Tree *tree);
+bt_Node *bt_walk_first(bt_Tree *tree, TraversalStrategy strategy);
 
 /**
- * @brief Balances tree using left and right rotations.
+ * @brief Steps to the node following node in a traversal according to strategy using the parent
+ * links.
  *
- * @param tree pointer to a tree to balance.
+ * @param node pointer to a node of a tree.
+ * @param strategy strategy to use (@see TraversalStrategy)
+ *
+ * @return pointer to the next node or NULL if node is the last one.
  */
-void bt_balance(bt_Tree *tree);
+bt_Node *bt_walk_next(bt_Node *node, TraversalStrategy strategy);
 
 /**
- * @brief prints tree to STDOUT using the given function for node data.
+ * @brief Calls fn for every node in the order given by strategy without allocating.
+ * fn must not change the tree, except that in POST_ORDER it may free the node it is called with.
  *
- * @param tree pointer to a tree to print.
- * @param to_str function used to convert data to a str.
- * The given string has a capacity of 128 characters.
- * Be carefull, the string pointer is reset for every node. So do not put your data in there.
+ * @param tree pointer to a tree to walk.
+ * @param strategy strategy to use (@see TraversalStrategy)
+ * @param fn function called with every node and ctx. Returning anything but 0 stops the walk.
+ * @param ctx pointer passed through to fn.
+ *
+ * @return 0 if all nodes were visited or the value fn stopped with.
  */
-void bt_print(bt_Tree *tree, void (*to_str)(void *, char *));
+int bt_foreach(bt_Tree *tree, TraversalStrategy strategy, int (*fn)(bt_Node *node, void *ctx),
+               void *ctx);
 
 /**
- * @brief prints the tree interpreting the data as integer numbers.
+ * @brief Writes the data of the next nodes of a traversal into buffer and advances cursor.
  *
- * @param tree pointer to a tree to print
+ * @param cursor pointer to the next node to read, initialized with bt_walk_first and NULL once
+ * the traversal is done.
+ * @param strategy strategy to use, has to be the one cursor was initialized with.
+ * @param buffer pointer to room for len data pointers.
+ * @param len number of data pointers buffer can hold.
+ *
+ * @return number of data pointers written, 0 once the traversal is done.
+ *
+ * @example Streaming a tree in chunks.
+ *   void *chunk[256];
+ *   size_t len;
+ *   bt_Node *cursor = bt_walk_first(tree, IN_ORDER);
+ *   while ((len = bt_read(&cursor, IN_ORDER, chunk, 256)) > 0) {
+ *       write_out(chunk, len);
+ *   }
  */
-void bt_print_int(bt_Tree *tree);
+size_t bt_read(bt_Node **cursor, TraversalStrategy strategy, void **buffer, size_t len);
 
 /**
- * @brief prints the tree interpreting the data as floating point numbers.
+ * @brief Appends all nodes of other to tree.
+ * Every data of tree has to be smaller than every data of other. The nodes of other are reused and
+ * other is left empty, it still has to be deleted by the caller.
  *
- * @param tree pointer to a tree to print
+ * @param tree pointer to a tree to join into.
+ * @param other pointer to a tree holding only data greater than the data of tree.
+ *
+ * @return true if the trees were joined or false if their orders overlap or differ or memory ran
+ * out.
  */
-void bt_print_float(bt_Tree *tree);
+bool bt_join(bt_Tree *tree, bt_Tree *other);
 
 /**
- * @brief deletes the tree and its data using the delete function set in bt_create.
- * The tree pointer is set to NULL after deletion.
+ * @brief Splits tree at data into a tree of smaller and a tree of greater or equal data.
+ * The nodes of tree are moved into the created trees and tree is left empty.
+ * Only the path down to data is rebuilt, which takes O(log n) for balanced trees and treaps.
  *
- * @param tree pointer to a tree to delete.
+ * @param tree pointer to a tree to split.
+ * @param data pointer to the data to split at.
+ * @param lt pointer to the created tree holding all data smaller than data.
+ * @param ge pointer to the created tree holding all data greater than or equal to data.
+ * If memory ran out, lt and ge are set to NULL and tree is left as it was.
  */
-void bt_delete(bt_Tree *tree);
-
-#endif // _B_TREE_
-
-#ifdef BINARY_TREE_IMPLEMENTATION
-#ifndef _BIN_TREE_IMPL_
-#define _BIN_TREE_IMPL_
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+void bt_split(bt_Tree *tree, void *data, bt_Tree **lt, bt_Tree **ge);
 
-// helper methods definition
-static int _cmp_int(void *d1, void *d2);
-static int _cmp_float(void *d1, void *d2);
-static void _int_to_str(void *data, char *str);
-static void _float_to_str(void *data, char *str);
-static int _add(bt_Node **node, bt_Node *parent, void *data, int (*compare)(void *d1, void *d2));
-static void _delete(bt_Tree *tree);
-static void _clear(bt_Node **root);
-static int _remove(bt_Node **node, void *data, int (*compare)(void *d1, void *d2));
-static int _traverse(bt_Node *node, TraversalStrategy strategy, bt_Node **array, size_t idx);
-static size_t _depth_at(bt_Node *node);
-static bool _is_balanced(bt_Node *node);
-static void _balance(bt_Node **node);
-static void _rotate_left(bt_Node **node);
-static void _rotate_right(bt_Node **node);
-static void _print(bt_Node *node, void (*to_str)(void *, char *), int level);
+/**
+ * @brief Merges all data of other into tree.
+ * Nodes are reused, data held by both trees is kept from tree and the duplicate is deleted using
+ * the delete function of other. other is left empty.
+ * For multisets the multiplicities of equal data are summed up.
+ *
+ * @param tree pointer to a tree receiving the union.
+ * @param other pointer to a tree with the same compare function.
+ *
+ * @return true if the union was built or false if the compare functions differ or memory ran
+ * out.
+ */
+bool bt_union(bt_Tree *tree, bt_Tree *other);
 
-bt_Tree *bt_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data)) {
-    bt_Tree *tree = (bt_Tree *)malloc(sizeof(bt_Tree));
-    tree->root = NULL;
-    tree->count = 0;
-    tree->compare = compare;
-    tree->delete = delete;
-    return tree;
-}
+/**
+ * @brief Keeps only the data of tree that is held by other as well.
+ * Dropped data is deleted using the delete function of the tree holding it. other is left empty.
+ * For multisets the smaller multiplicity of equal data is kept.
+ *
+ * @param tree pointer to a tree receiving the intersection.
+ * @param other pointer to a tree with the same compare function.
+ *
+ * @return true if the intersection was built or false if the compare functions differ or memory ran
+ * out.
+ */
+bool bt_intersect(bt_Tree *tree, bt_Tree *other);
 
-bt_Tree *bt_create_int(void (*delete)(void *data)) { return bt_create(&_cmp_int, delete); }
-bt_Tree *bt_create_float(void (*delete)(void *data)) { return bt_create(&_cmp_float, delete); }
+/**
+ * @brief Removes all data of other from tree.
+ * Dropped data is deleted using the delete function of the tree holding it. other is left empty.
+ * For multisets the multiplicities of other are subtracted.
+ *
+ * @param tree pointer to a tree receiving the difference.
+ * @param other pointer to a tree with the same compare function.
+ *
+ * @return true if the difference was built or false if the compare functions differ or memory ran
+ * out.
+ */
+bool bt_difference(bt_Tree *tree, bt_Tree *other);
 
-bool bt_add(bt_Tree *tree, void *data) {
-    size_t added = _add(&tree->root, NULL, data, tree->compare);
-    tree->count += added;
-    _balance(&tree->root);
-    if (added == 1) {
-        return true;
-    } else {
-        return false;
-    }
-}
+/**
+ * @brief Turns tree into an interval tree.
+ * Every node keeps track of the greatest high endpoint within its subtree which allows to find all
+ * overlapping intervals in O(log n + k). The compare function of the tree has to order the
+ * intervals by their low endpoint first.
+ *
+ * @param tree pointer to a tree holding intervals as data (or keys of a map).
+ * @param low function returning a pointer to the low endpoint of an interval.
+ * @param high function returning a pointer to the high endpoint of an interval.
+ * @param compare_point Comparison function for two endpoints.
+ * p1 < p2 return -1 .
+ * p1 = p2 return  0 .
+ * p1 > p2 return  1 .
+ *
+ * @return true if the interval mode was enabled or false if the tree holds or reserved nodes.
+ */
+bool bt_enable_interval(bt_Tree *tree, void *(*low)(void *data), void *(*high)(void *data),
+                        int (*compare_point)(void *p1, void *p2));
 
-bool bt_remove(bt_Tree *tree, void *data) {
-    size_t removed = _remove(&tree->root, data, tree->compare);
-    tree->count -= removed;
-    _balance(&tree->root);
-    if (removed == 1) {
-        return true;
-    } else {
-        return false;
-    }
-}
+/**
+ * @brief Reports all intervals overlapping [lo, hi] (endpoints included).
+ *
+ * @example Finding the intervals containing the point t.
+ *   size_t hits = bt_overlaps(tree, &t, &t, print_interval, NULL);
+ *
+ * @param tree pointer to an interval tree.
+ * @param lo pointer to the low endpoint of the queried interval.
+ * @param hi pointer to the high endpoint of the queried interval.
+ * @param found function called in order for every node holding an overlapping interval.
+ * @param ctx pointer passed through to found.
+ *
+ * @return the number of overlapping intervals.
+ */
+size_t bt_overlaps(bt_Tree *tree, void *lo, void *hi, void (*found)(bt_Node *node, void *ctx),
+                   void *ctx);
 
-void bt_traverse(bt_Tree *tree, TraversalStrategy strategy, bt_Node ***traversal) {
-    *traversal = (bt_Node **)malloc(tree->count * sizeof(bt_Node *));
-    size_t traversed = _traverse(tree->root, strategy, *traversal, 0);
-}
+/**
+ * @brief Adds a user defined subtree aggregate (a monoid) to every node of an empty tree.
+ * The aggregates are kept up to date on every change of the tree and allow range aggregates in
+ * O(log n), e.g. sums, minima or maxima of values.
+ *
+ * @param tree pointer to an empty tree.
+ * @param aggregate_size size of an aggregate in bytes.
+ * @param lift function writing the aggregate of a single node to out.
+ * @param combine function writing the aggregate of a followed by b to out. out may point to the
+ * same memory as a or b.
+ * @param identity pointer to the aggregate of no nodes, it has to outlive the tree.
+ *
+ * @return true if the aggregate was enabled or false if the tree holds or reserved nodes.
+ */
+bool bt_enable_aggregate(bt_Tree *tree, size_t aggregate_size, void (*lift)(bt_Node *node, void *out),
+                         void (*combine)(void *out, const void *a, const void *b),
+                         const void *identity);
 
-bool bt_is_balanced(bt_Tree *tree) { return _is_balanced(tree->root); }
+/**
+ * @brief Returns the aggregate of the subtree of node.
+ *
+ * @param tree pointer to a tree with enabled aggregate.
+ * @param node pointer to a node of this tree.
+ *
+ * @return pointer to the aggregate stored with node.
+ */
+void *bt_node_aggregate(bt_Tree *tree, bt_Node *node);
 
-void bt_balance(bt_Tree *tree) { _balance(&tree->root); }
+/**
+ * @brief Returns the value slot of a node of a map, e.g. to read values in the lift function of an
+ * aggregate.
+ *
+ * @param node pointer to a node of a map.
+ *
+ * @return pointer to the value stored with node.
+ */
+void **bt_node_value(bt_Node *node);
+
+/**
+ * @brief Aggregates all nodes holding data between lo and hi (both included) in order.
+ *
+ * @example Summing up the values of a map for the keys in [a, b].
+ *   long sum;
+ *   bt_range_aggregate(tree, &a, &b, &sum);
+ *
+ * @param tree pointer to a tree with enabled aggregate.
+ * @param lo pointer to the lower bound of the range.
+ * @param hi pointer to the upper bound of the range.
+ * @param out pointer to memory of aggregate_size bytes receiving the result.
+ *
+ * @return true if the aggregate was computed or false if there is no memory for it.
+ */
+bool bt_range_aggregate(bt_Tree *tree, void *lo, void *hi, void *out);
+
+/**
+ * @brief Caches a normalized key prefix inline in every node of an empty tree.
+ * Descents compare the prefixes as integers first and call compare only if they are equal, which
+ * avoids most pointer chases and byte loops for keys like strings with long common prefixes.
+ *
+ * @param tree pointer to a tree.
+ * @param normalize function mapping data to an integer such that normalize(d1) < normalize(d2)
+ * implies d1 < d2. For strings ordered by strcmp provide bt_prefix_str.
+ *
+ * @return true if the prefix mode was enabled or false if the tree holds or reserved nodes.
+ */
+bool bt_enable_prefix(bt_Tree *tree, uint64_t (*normalize)(void *data));
+
+/**
+ * @brief Normalizes a zero terminated string into its first 8 bytes in big endian order.
+ * Orders like strcmp as far as the first 8 characters go.
+ *
+ * @param data pointer to a zero terminated string.
+ *
+ * @return the normalized prefix of the string.
+ */
+uint64_t bt_prefix_str(void *data);
+
+/**
+ * @brief Counters a filter spends per expected node, 8 give about 2.5% false positives.
+ */
+#define BT_FILTER_COUNTERS 8
+
+/**
+ * @brief Maintains a counting bloom filter over the data of tree.
+ * bt_find, bt_remove and the lookups built on them return right away for data the filter rules
+ * out, which spares the descent for most absent data. Adds and removes keep the filter up to date,
+ * bt_split and the set operations rebuild it in O(n).
+ *
+ * @param tree pointer to a tree.
+ * @param hash function hashing data, equal data has to hash equally. NULL disables the filter.
+ * @param expected number of nodes the filter is sized for, false positives grow beyond it.
+ *
+ * @return BT_OK or BT_ENOMEM if the filter could not be allocated, which leaves it disabled.
+ */
+bt_Status bt_enable_filter(bt_Tree *tree, uint64_t (*hash)(void *data), size_t expected);
+
+/**
+ * @brief Makes tree allocate its nodes through node_alloc and free them through node_free, e.g. to
+ * carve them from an arena. Set it before the first add. Trees created from tree by bt_split use
+ * the same allocator and trees can only be joined or merged if they share it.
+ *
+ * @param tree pointer to an empty tree.
+ * @param node_alloc function returning size bytes aligned like malloc does. NULL restores malloc.
+ * @param node_free function freeing a node returned by node_alloc.
+ * @param ctx pointer passed through to node_alloc and node_free.
+ *
+ * @return true if the allocator was set or false if the tree holds nodes.
+ */
+bool bt_set_allocator(bt_Tree *tree, void *(*node_alloc)(size_t size, void *ctx),
+                      void (*node_free)(void *node, void *ctx), void *ctx);
+
+/**
+ * @brief Tests if tree is completely balanced.
+ * This required all nodes in the tree to be balanced.
+ *
+ * @param tree pointer to a tree to check for balance.
+ *
+ * @return true if tree is balanced or false otherwise.
+ */
+bool bt_is_balanced(bt_Tree *tree);
+
+/**
+ * @brief Balances tree using left and right rotations.
+ * Treaps are kept in the shape given by their priorities and left untouched.
+ *
+ * @param tree pointer to a tree to balance.
+ */
+void bt_balance(bt_Tree *tree);
+
+/**
+ * @brief Does a bounded amount of the balancing left behind by DEFERRED_BALANCE.
+ * Walks depth first through the unbalanced subtrees, which adds and removes keep track of, and
+ * rebuilds every one whose children are balanced by joining them. Every node the walk passes costs
+ * one unit of work and a join the difference of the heights of the children. The walk continues
+ * where the last call stopped, so a call never does much more than max_work.
+ *
+ * @param tree pointer to a tree to balance.
+ * @param max_work number of nodes the call may visit, it does at least one step regardless.
+ *
+ * @return true if the tree is completely balanced or false if work is left, always true for treaps.
+ *
+ * @example Balancing in idle time.
+ *   tree->balance = DEFERRED_BALANCE;
+ *   // bursts of bt_add and bt_remove
+ *   while (idle() && !bt_balance_step(tree, 1024)) {
+ *   }
+ */
+bool bt_balance_step(bt_Tree *tree, size_t max_work);
+
+/**
+ * @brief Size and alignment of the regions bt_compact relocates nodes to.
+ */
+#define BT_COMPACT_REGION (256 * 1024)
+
+/**
+ * @brief Relocates all nodes of tree in order into contiguous regions.
+ * After long churn the nodes are scattered over the heap, afterwards scans read memory sequentially
+ * and lookups touch fewer pages and cache lines. A region is freed once none of its nodes is left.
+ * Trees with an allocator set by bt_set_allocator relocate their nodes through it in order instead.
+ * Pointers to nodes of tree are invalid afterwards.
+ *
+ * @param tree pointer to a tree to compact.
+ */
+void bt_compact(bt_Tree *tree);
+
+/**
+ * @brief Relocates up to max_work nodes of tree, continuing where the last call stopped.
+ * Adds and removes may happen between the calls, nodes added behind the position reached are only
+ * relocated by the next pass. If memory runs out the call stops early and the next one retries.
+ *
+ * @param tree pointer to a tree to compact.
+ * @param max_work number of nodes to relocate at most.
+ *
+ * @return true if a pass over all nodes was finished or false if work is left.
+ */
+bool bt_compact_step(bt_Tree *tree, size_t max_work);
+
+/**
+ * @brief prints tree to STDOUT using the given function for node data.
+ *
+ * @param tree pointer to a tree to print.
+ * @param to_str function used to convert data to a str.
+ * The given string has a capacity of 128 characters.
+ * Be carefull, the string pointer is reset for every node. So do not put your data in there.
+ */
+void bt_print(bt_Tree *tree, void (*to_str)(void *, char *));
+
+/**
+ * @brief Size of the buffer bt_dump formats into before handing it to the writer.
+ */
+#define BT_DUMP_BUFFER 8192
+
+/**
+ * @brief Writes tree in the format of bt_print through writer.
+ * The output is formatted into a buffer on the stack and handed to writer in blocks of up to
+ * BT_DUMP_BUFFER bytes, so several trees can be dumped concurrently.
+ *
+ * @param tree pointer to a tree to dump.
+ * @param to_str function used to convert data to a str.
+ * The given string has a capacity of 128 characters.
+ * @param writer function called with every filled block, its length and ctx. Returning false
+ * aborts the dump.
+ * @param ctx pointer passed through to writer.
+ *
+ * @return true if the whole tree was written or false if writer failed.
+ *
+ * @example Dumping a tree into a file.
+ *   FILE *file = fopen("tree.txt", "w");
+ *   bt_dump(tree, to_str, bt_write_file, file);
+ *   fclose(file);
+ */
+bool bt_dump(bt_Tree *tree, void (*to_str)(void *, char *),
+             bool (*writer)(const char *buffer, size_t len, void *ctx), void *ctx);
+
+/**
+ * @brief Writer for bt_dump appending to a FILE.
+ *
+ * @param ctx pointer to the FILE to write to.
+ */
+bool bt_write_file(const char *buffer, size_t len, void *ctx);
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * @brief Writer for bt_dump writing to a file descriptor, bypassing stdio buffering.
+ *
+ * @param ctx pointer to an int holding the file descriptor to write to.
+ */
+bool bt_write_fd(const char *buffer, size_t len, void *ctx);
+#endif
+
+/**
+ * @brief prints the tree interpreting the data as integer numbers.
+ *
+ * @param tree pointer to a tree to print
+ */
+void bt_print_int(bt_Tree *tree);
+
+/**
+ * @brief prints the tree interpreting the data as floating point numbers.
+ *
+ * @param tree pointer to a tree to print
+ */
+void bt_print_float(bt_Tree *tree);
+
+/**
+ * @brief deletes the tree and its data using the delete function set in bt_create.
+ * The tree pointer is set to NULL after deletion.
+ *
+ * @param tree pointer to a tree to delete.
+ */
+void bt_delete(bt_Tree *tree);
+
+#endif // _B_TREE_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _BIN_TREE_IMPL_
+#define _BIN_TREE_IMPL_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+// fields behind a node in the order they are stored, the aggregate and the key are present by their
+// size, the others by the layout of the tree
+#define BT_LAYOUT_VALUE 1
+#define BT_LAYOUT_AGGREGATE 2
+#define BT_LAYOUT_HIGH 4
+#define BT_LAYOUT_PREFIX 8
+#define BT_LAYOUT_PRIORITY 16
+#define BT_LAYOUT_KEY 32
+
+// header of a region bt_compact relocates nodes to, the nodes follow behind it
+struct bt_Region {
+    // nodes placed in the region and not freed yet
+    size_t live;
+    // bytes of the region handed out, including this header
+    size_t used;
+    // true while a tree is placing nodes in the region, it is not freed then
+    bool filling;
+};
+
+// state of a running bt_dump
+typedef struct {
+    char buffer[BT_DUMP_BUFFER];
+    size_t len;
+    bool (*writer)(const char *buffer, size_t len, void *ctx);
+    void *ctx;
+    bool ok;
+} bt_Dump;
+
+// helper methods definition
+static int _cmp_int(void *d1, void *d2);
+static int _cmp_float(void *d1, void *d2);
+static void _int_to_str(void *data, char *str);
+static void _float_to_str(void *data, char *str);
+static bt_Status _add(bt_Tree *tree, void *data, void *value, bt_Node **at);
+static bt_Tree *_create_like(bt_Tree *tree);
+static bool _compatible(bt_Tree *tree, bt_Tree *other);
+static void _settle(bt_Tree *tree);
+static size_t _trailer(bt_Tree *tree, unsigned int field);
+static size_t _node_size(bt_Tree *tree);
+static void *_field(bt_Tree *tree, bt_Node *node, unsigned int field);
+static void **_max_high(bt_Tree *tree, bt_Node *node);
+static uint64_t _node_prefix(bt_Tree *tree, bt_Node *node);
+static void _store_prefix(bt_Tree *tree, bt_Node *node, uint64_t prefix);
+static unsigned int _priority(bt_Tree *tree, bt_Node *node);
+static bt_Node *_alloc_node(bt_Tree *tree);
+static void _free_node(bt_Tree *tree, bt_Node *node);
+static void _unreserve(bt_Tree *tree);
+static void _remove(bt_Tree *tree, bt_Node **link);
+static size_t _small_stride(bt_Tree *tree);
+static bool _small_open(bt_Tree *tree);
+static bt_Node *_small_alloc(bt_Tree *tree);
+static void _small_free(bt_Tree *tree);
+static bt_Node *_small_insert(bt_Tree *tree, bt_Node *parent, bool right);
+static void _small_remove(bt_Tree *tree, bt_Node *node);
+static bt_Node *_small_link(bt_Tree *tree, size_t lo, size_t hi, bt_Node *parent);
+static bool _promote(bt_Tree *tree);
+static void _demote(bt_Tree *tree);
+static bt_Node *_relocate(bt_Tree *tree, bt_Node *node);
+static void _region_close(bt_Tree *tree);
+static void _compact_reset(bt_Tree *tree);
+static void _release(bt_Tree *tree, bt_Node *node);
+static void _delete(bt_Tree *tree);
+static bt_Node *_unlink(bt_Node **link);
+static void _update(bt_Tree *tree, bt_Node *node);
+static void _update_path(bt_Tree *tree, bt_Node *node);
+static void _refresh(bt_Tree *tree, bt_Node *node);
+static bt_Node **_link_of(bt_Tree *tree, bt_Node *node);
+static bt_Node *_bound(bt_Tree *tree, void *data, int limit);
+static bt_Node *_leftmost(bt_Node *node);
+static bt_Node *_rightmost(bt_Node *node);
+static bt_Node **_find_link(bt_Tree *tree, void *data);
+static bt_Node **_finger_link(bt_Tree *tree, void *data, uint64_t prefix);
+static uint64_t _prefix(bt_Tree *tree, void *data);
+static int _compare(bt_Tree *tree, void *data, uint64_t prefix, bt_Node *node);
+static int _traverse(bt_Node *node, TraversalStrategy strategy, bt_Node **array, size_t idx);
+static bt_Node *_post_first(bt_Node *node);
+static size_t _depth_at(bt_Node *node);
+static bool _is_balanced(bt_Node *node);
+static void _balance(bt_Tree *tree, bt_Node **node);
+static void _rebalance(bt_Tree *tree, bt_Node *node, bool added);
+static void _retrace(bt_Tree *tree, bt_Node *node);
+static void _bubble(bt_Tree *tree, bt_Node *node);
+static bt_Node **_sink(bt_Tree *tree, bt_Node **link);
+static unsigned int _random(bt_Tree *tree);
+static void _scapegoat(bt_Tree *tree, bt_Node *added);
+static void _rebuild(bt_Tree *tree, bt_Node **link);
+static bt_Node *_build(bt_Tree *tree, size_t count, bt_Node **list);
+static void _rotate_left(bt_Tree *tree, bt_Node **node);
+static void _rotate_right(bt_Tree *tree, bt_Node **node);
+static void _dump_put(bt_Dump *dump, const char *str, size_t len);
+static void _dump_node(bt_Dump *dump, bt_Node *node, void (*to_str)(void *, char *), size_t level);
+static size_t _overlaps(bt_Tree *tree, bt_Node *node, void *lo, void *hi,
+                        void (*found)(bt_Node *node, void *ctx), void *ctx);
+static bt_Node *_make(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right);
+static void _expose(bt_Node *node, bt_Node **left, bt_Node **right);
+static bt_Node *_join(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right);
+static bt_Node *_join_treap(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right);
+static bt_Node *_join_left(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right);
+static bt_Node *_join_right(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right);
+static bt_Node *_join2(bt_Tree *tree, bt_Node *left, bt_Node *right);
+static bt_Node *_split_last(bt_Tree *tree, bt_Node *node, bt_Node **last);
+static bt_Node *_split(bt_Tree *tree, bt_Node *node, void *data, uint64_t prefix, bt_Node **lt,
+                       bt_Node **gt);
+static bt_Node *_union(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node);
+static bt_Node *_intersect(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node);
+static bt_Node *_difference(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node);
+static void _discard(bt_Tree *tree, bt_Node *node);
+static uint64_t _mix(uint64_t hash);
+static void _filter_update(bt_Tree *tree, void *data, int delta);
+static bool _filter_check(bt_Tree *tree, void *data);
+static void _filter_rebuild(bt_Tree *tree);
+
+bt_Tree *bt_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data)) {
+    bt_Tree *tree = (bt_Tree *)malloc(sizeof(bt_Tree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->root = NULL;
+    tree->count = 0;
+    tree->compare = compare;
+    tree->delete = delete;
+    tree->multiset = false;
+    tree->map = false;
+    tree->layout = 0;
+    tree->key_size = 0;
+    tree->low = NULL;
+    tree->high = NULL;
+    tree->compare_point = NULL;
+    tree->aggregate_size = 0;
+    tree->lift = NULL;
+    tree->combine = NULL;
+    tree->identity = NULL;
+    tree->normalize = NULL;
+    tree->hash = NULL;
+    tree->filter = NULL;
+    tree->filter_size = 0;
+    tree->balance = EAGER_BALANCE;
+    tree->balance_cursor = NULL;
+    tree->max_count = 0;
+    tree->rng = 0;
+    tree->node_alloc = NULL;
+    tree->node_free = NULL;
+    tree->allocator = NULL;
+    tree->compact_cursor = NULL;
+    tree->compact_region = NULL;
+    tree->reserve = NULL;
+    tree->reserved = 0;
+    tree->small_max = 0;
+    tree->small = NULL;
+    tree->finger = false;
+    tree->finger_node = NULL;
+    return tree;
+}
+
+bt_Tree *bt_create_map(int (*compare)(void *d1, void *d2), size_t key_size,
+                       void (*delete)(void *value)) {
+    bt_Tree *tree = bt_create(compare, delete);
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->map = true;
+    tree->key_size = key_size;
+    _settle(tree);
+    return tree;
+}
+
+bt_Tree *bt_create_int(void (*delete)(void *data)) { return bt_create(&_cmp_int, delete); }
+bt_Tree *bt_create_float(void (*delete)(void *data)) { return bt_create(&_cmp_float, delete); }
+
+bool bt_add(bt_Tree *tree, void *data) { return bt_try_add(tree, data) == BT_OK; }
+
+bt_Status bt_try_add(bt_Tree *tree, void *data) {
+    bt_Node *node;
+    bt_Status status = _add(tree, data, NULL, &node);
+    if (status == BT_OK) {
+        tree->count += 1;
+        _rebalance(tree, node, true);
+    } else if (status == BT_EXISTS && tree->multiset) {
+        node->multiplicity += 1;
+        _refresh(tree, node);
+        status = BT_OK;
+    }
+    return status;
+}
+
+bt_Status bt_upsert(bt_Tree *tree, void *data, bt_Node **node) {
+    bt_Status status = _add(tree, data, NULL, node);
+    if (status == BT_OK) {
+        tree->count += 1;
+        _rebalance(tree, *node, true);
+    }
+    return status;
+}
+
+bt_Status bt_reserve(bt_Tree *tree, size_t n) {
+    // adds into a block would not take the reserved nodes
+    if (n > 0 && !_promote(tree)) {
+        return BT_ENOMEM;
+    }
+    _settle(tree);
+    size_t size = _node_size(tree);
+    while (tree->reserved < n) {
+        bt_Node *node;
+        if (tree->node_alloc != NULL) {
+            node = (bt_Node *)tree->node_alloc(size, tree->allocator);
+        } else {
+            node = (bt_Node *)malloc(size);
+        }
+        if (node == NULL) {
+            return BT_ENOMEM;
+        }
+        node->compacted = 0;
+        node->right = tree->reserve;
+        tree->reserve = node;
+        tree->reserved += 1;
+    }
+    return BT_OK;
+}
+
+bool bt_add_or_update(bt_Tree *tree, void *data, void *(*merge)(void *existing, void *data)) {
+    bt_Node *node;
+    bt_Status status = _add(tree, data, NULL, &node);
+    if (status == BT_OK) {
+        tree->count += 1;
+        _rebalance(tree, node, true);
+        return true;
+    } else if (status == BT_ENOMEM) {
+        return false;
+    }
+
+    void *merged = merge(node->data, data);
+    if (tree->key_size == 0) {
+        node->data = merged;
+    } else if (merged != node->data) {
+        memcpy(node->data, merged, tree->key_size);
+    }
+    _store_prefix(tree, node, _prefix(tree, node->data));
+    _refresh(tree, node);
+    return false;
+}
+
+bool bt_put(bt_Tree *tree, void *key, void *value, void **old) {
+    bt_Node *node;
+    bt_Status status = _add(tree, key, value, &node);
+    if (status == BT_OK) {
+        if (old != NULL) {
+            *old = NULL;
+        }
+        tree->count += 1;
+        _rebalance(tree, node, true);
+        return true;
+    } else if (status == BT_ENOMEM) {
+        // the value was not taken, it is handed back like a replaced one
+        if (old != NULL) {
+            *old = value;
+        }
+        return false;
+    }
+
+    if (old != NULL) {
+        *old = *bt_node_value(node);
+    }
+    *bt_node_value(node) = value;
+    _refresh(tree, node);
+    return false;
+}
+
+void *bt_get(bt_Tree *tree, void *key) {
+    bt_Node *node = bt_find(tree, key);
+    if (node == NULL) {
+        return NULL;
+    }
+    return *bt_node_value(node);
+}
+
+size_t bt_multiplicity(bt_Tree *tree, void *data) {
+    bt_Node *node = bt_find(tree, data);
+    if (node == NULL) {
+        return 0;
+    }
+    return node->multiplicity;
+}
+
+bool bt_remove(bt_Tree *tree, void *data) {
+    if (!_filter_check(tree, data)) {
+        return false;
+    }
+
+    bt_Node **link = _find_link(tree, data);
+    bt_Node *found = *link;
+    if (found == NULL) {
+        return false;
+    }
+
+    if (tree->multiset && found->multiplicity > 1) {
+        found->multiplicity -= 1;
+        _refresh(tree, found);
+        return true;
+    }
+
+    _remove(tree, link);
+    return true;
+}
+
+bool bt_remove_node(bt_Tree *tree, bt_Node *node) {
+    if (node == NULL) {
+        return false;
+    }
+
+    _remove(tree, _link_of(tree, node));
+    return true;
+}
+
+bt_Node *bt_find(bt_Tree *tree, void *data) {
+    if (!_filter_check(tree, data)) {
+        return NULL;
+    }
+    return *_find_link(tree, data);
+}
+
+bt_Node *bt_lower_bound(bt_Tree *tree, void *data) {
+    return _bound(tree, data, 0);
+}
+
+bt_Node *bt_upper_bound(bt_Tree *tree, void *data) {
+    return _bound(tree, data, -1);
+}
+
+bt_Node *bt_first(bt_Tree *tree) { return _leftmost(tree->root); }
+
+bt_Node *bt_last(bt_Tree *tree) { return _rightmost(tree->root); }
+
+bt_Node *bt_next(bt_Node *node) {
+    if (node->right != NULL) {
+        return _leftmost(node->right);
+    }
+    while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+bt_Node *bt_prev(bt_Node *node) {
+    if (node->left != NULL) {
+        return _rightmost(node->left);
+    }
+    while (node->parent != NULL && node->parent->left == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+bt_Status bt_traverse(bt_Tree *tree, TraversalStrategy strategy, bt_Node ***traversal) {
+    *traversal = (bt_Node **)malloc(tree->count * sizeof(bt_Node *));
+    if (*traversal == NULL && tree->count > 0) {
+        return BT_ENOMEM;
+    }
+    _traverse(tree->root, strategy, *traversal, 0);
+    return BT_OK;
+}
+
+bt_Node *bt_walk_first(bt_Tree *tree, TraversalStrategy strategy) {
+    switch (strategy) {
+    case PRE_ORDER:
+        return tree->root;
+    case IN_ORDER:
+        return _leftmost(tree->root);
+    default:
+        return _post_first(tree->root);
+    }
+}
+
+bt_Node *bt_walk_next(bt_Node *node, TraversalStrategy strategy) {
+    bt_Node *parent = node->parent;
+    switch (strategy) {
+    case PRE_ORDER:
+        if (node->left != NULL) {
+            return node->left;
+        }
+        if (node->right != NULL) {
+            return node->right;
+        }
+        // climb until there is a right subtree not visited yet
+        while (parent != NULL && (parent->right == node || parent->right == NULL)) {
+            node = parent;
+            parent = node->parent;
+        }
+        return parent != NULL ? parent->right : NULL;
+    case IN_ORDER:
+        return bt_next(node);
+    default:
+        if (parent != NULL && parent->left == node && parent->right != NULL) {
+            return _post_first(parent->right);
+        }
+        return parent;
+    }
+}
+
+int bt_foreach(bt_Tree *tree, TraversalStrategy strategy, int (*fn)(bt_Node *node, void *ctx),
+               void *ctx) {
+    bt_Node *node = bt_walk_first(tree, strategy);
+    while (node != NULL) {
+        // step before calling fn, post order never comes back to a visited node
+        bt_Node *next = bt_walk_next(node, strategy);
+        int stop = fn(node, ctx);
+        if (stop != 0) {
+            return stop;
+        }
+        node = next;
+    }
+    return 0;
+}
+
+size_t bt_read(bt_Node **cursor, TraversalStrategy strategy, void **buffer, size_t len) {
+    size_t idx = 0;
+    while (idx < len && *cursor != NULL) {
+        buffer[idx++] = (*cursor)->data;
+        *cursor = bt_walk_next(*cursor, strategy);
+    }
+    return idx;
+}
+
+bool bt_join(bt_Tree *tree, bt_Tree *other) {
+    if (!_compatible(tree, other) || !_promote(tree) || !_promote(other)) {
+        return false;
+    }
+    if (tree->root != NULL && other->root != NULL &&
+        tree->compare(bt_last(tree)->data, bt_first(other)->data) >= 0) {
+        return false;
+    }
+
+    tree->root = _join2(tree, tree->root, other->root);
+    tree->count += other->count;
+    other->root = NULL;
+    other->count = 0;
+    other->finger_node = NULL;
+    other->balance_cursor = NULL;
+    _compact_reset(other);
+
+    // counting filters over disjoint data add up
+    if (tree->filter != NULL && other->filter != NULL && tree->hash == other->hash &&
+        tree->filter_size == other->filter_size) {
+        size_t idx;
+        for (idx = 0; idx < tree->filter_size; idx++) {
+            unsigned int sum = tree->filter[idx] + other->filter[idx];
+            tree->filter[idx] = sum > UINT8_MAX ? UINT8_MAX : (uint8_t)sum;
+        }
+    } else {
+        _filter_rebuild(tree);
+    }
+    _filter_rebuild(other);
+    return true;
+}
+
+void bt_split(bt_Tree *tree, void *data, bt_Tree **lt, bt_Tree **ge) {
+    *lt = _create_like(tree);
+    *ge = _create_like(tree);
+    if (*lt == NULL || *ge == NULL || !_promote(tree)) {
+        if (*lt != NULL) {
+            bt_delete(*lt);
+        }
+        if (*ge != NULL) {
+            bt_delete(*ge);
+        }
+        *lt = NULL;
+        *ge = NULL;
+        return;
+    }
+
+    bt_Node *gt = NULL;
+    bt_Node *found = _split(tree, tree->root, data, _prefix(tree, data), &(*lt)->root, &gt);
+    if (found != NULL) {
+        gt = _join(tree, NULL, found, gt);
+    }
+    (*ge)->root = gt;
+
+    (*lt)->count = (*lt)->root != NULL ? (*lt)->root->size : 0;
+    (*ge)->count = gt != NULL ? gt->size : 0;
+    tree->root = NULL;
+    tree->count = 0;
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    _compact_reset(tree);
+    _filter_rebuild(*lt);
+    _filter_rebuild(*ge);
+    _filter_rebuild(tree);
+}
+
+bool bt_union(bt_Tree *tree, bt_Tree *other) {
+    if (!_compatible(tree, other) || !_promote(tree) || !_promote(other)) {
+        return false;
+    }
+
+    tree->root = _union(tree, tree->root, other, other->root);
+    tree->count = tree->root != NULL ? tree->root->size : 0;
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    other->root = NULL;
+    other->count = 0;
+    other->finger_node = NULL;
+    other->balance_cursor = NULL;
+    _compact_reset(other);
+    _filter_rebuild(tree);
+    _filter_rebuild(other);
+    return true;
+}
+
+bool bt_intersect(bt_Tree *tree, bt_Tree *other) {
+    if (!_compatible(tree, other) || !_promote(tree) || !_promote(other)) {
+        return false;
+    }
+
+    _compact_reset(tree);
+    tree->root = _intersect(tree, tree->root, other, other->root);
+    tree->count = tree->root != NULL ? tree->root->size : 0;
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    other->root = NULL;
+    other->count = 0;
+    other->finger_node = NULL;
+    other->balance_cursor = NULL;
+    _compact_reset(other);
+    _filter_rebuild(tree);
+    _filter_rebuild(other);
+    return true;
+}
+
+bool bt_difference(bt_Tree *tree, bt_Tree *other) {
+    if (!_compatible(tree, other) || !_promote(tree) || !_promote(other)) {
+        return false;
+    }
+
+    _compact_reset(tree);
+    tree->root = _difference(tree, tree->root, other, other->root);
+    tree->count = tree->root != NULL ? tree->root->size : 0;
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    other->root = NULL;
+    other->count = 0;
+    other->finger_node = NULL;
+    other->balance_cursor = NULL;
+    _compact_reset(other);
+    _filter_rebuild(tree);
+    _filter_rebuild(other);
+    return true;
+}
+
+bool bt_enable_interval(bt_Tree *tree, void *(*low)(void *data), void *(*high)(void *data),
+                        int (*compare_point)(void *p1, void *p2)) {
+    if (tree->root != NULL || tree->small != NULL || tree->reserve != NULL) {
+        return false;
+    }
+
+    tree->low = low;
+    tree->high = high;
+    tree->compare_point = compare_point;
+    _settle(tree);
+    return true;
+}
+
+size_t bt_overlaps(bt_Tree *tree, void *lo, void *hi, void (*found)(bt_Node *node, void *ctx),
+                   void *ctx) {
+    return _overlaps(tree, tree->root, lo, hi, found, ctx);
+}
+
+bool bt_enable_aggregate(bt_Tree *tree, size_t aggregate_size, void (*lift)(bt_Node *node, void *out),
+                         void (*combine)(void *out, const void *a, const void *b),
+                         const void *identity) {
+    if (tree->root != NULL || tree->small != NULL || tree->reserve != NULL) {
+        return false;
+    }
+
+    tree->aggregate_size = aggregate_size;
+    tree->lift = lift;
+    tree->combine = combine;
+    tree->identity = identity;
+    return true;
+}
+
+void *bt_node_aggregate(bt_Tree *tree, bt_Node *node) {
+    return _field(tree, node, BT_LAYOUT_AGGREGATE);
+}
+
+void **bt_node_value(bt_Node *node) { return (void **)(node + 1); }
+
+bool bt_range_aggregate(bt_Tree *tree, void *lo, void *hi, void *out) {
+    uint64_t lo_prefix = _prefix(tree, lo);
+    uint64_t hi_prefix = _prefix(tree, hi);
+    bt_Node *split = tree->root;
+    while (split != NULL) {
+        if (_compare(tree, lo, lo_prefix, split) >= 1) {
+            split = split->right;
+        } else if (_compare(tree, hi, hi_prefix, split) <= -1) {
+            split = split->left;
+        } else {
+            break;
+        }
+    }
+
+    memcpy(out, tree->identity, tree->aggregate_size);
+    if (split == NULL) {
+        return true;
+    }
+
+    void *lifted = malloc(tree->aggregate_size);
+    if (lifted == NULL) {
+        return false;
+    }
+
+    // everything not less than lo left of split, collected from the inside out
+    bt_Node *node = split->left;
+    while (node != NULL) {
+        if (_compare(tree, lo, lo_prefix, node) <= 0) {
+            tree->lift(node, lifted);
+            if (node->right != NULL) {
+                tree->combine(lifted, lifted, bt_node_aggregate(tree, node->right));
+            }
+            tree->combine(out, lifted, out);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    tree->lift(split, lifted);
+    tree->combine(out, out, lifted);
+
+    // everything not greater than hi right of split, collected from the inside out
+    node = split->right;
+    while (node != NULL) {
+        if (_compare(tree, hi, hi_prefix, node) >= 0) {
+            if (node->left != NULL) {
+                tree->combine(out, out, bt_node_aggregate(tree, node->left));
+            }
+            tree->lift(node, lifted);
+            tree->combine(out, out, lifted);
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+
+    free(lifted);
+    return true;
+}
+
+bool bt_enable_prefix(bt_Tree *tree, uint64_t (*normalize)(void *data)) {
+    if (tree->root != NULL || tree->small != NULL || tree->reserve != NULL) {
+        return false;
+    }
+
+    tree->normalize = normalize;
+    _settle(tree);
+    return true;
+}
+
+uint64_t bt_prefix_str(void *data) {
+    const unsigned char *str = (const unsigned char *)data;
+    uint64_t prefix = 0;
+    size_t idx;
+    for (idx = 0; idx < sizeof(uint64_t); idx++) {
+        prefix <<= 8;
+        if (*str != '\0') {
+            prefix |= *str++;
+        }
+    }
+    return prefix;
+}
+
+bt_Status bt_enable_filter(bt_Tree *tree, uint64_t (*hash)(void *data), size_t expected) {
+    free(tree->filter);
+    tree->hash = hash;
+    tree->filter = NULL;
+    tree->filter_size = 0;
+    if (hash == NULL) {
+        return BT_OK;
+    }
+
+    size_t needed = (expected > tree->count ? expected : tree->count) * BT_FILTER_COUNTERS;
+    tree->filter_size = 64;
+    while (tree->filter_size < needed) {
+        tree->filter_size <<= 1;
+    }
+    tree->filter = (uint8_t *)calloc(tree->filter_size, sizeof(uint8_t));
+    if (tree->filter == NULL) {
+        tree->hash = NULL;
+        tree->filter_size = 0;
+        return BT_ENOMEM;
+    }
+    _filter_rebuild(tree);
+    return BT_OK;
+}
+
+bool bt_set_allocator(bt_Tree *tree, void *(*node_alloc)(size_t size, void *ctx),
+                      void (*node_free)(void *node, void *ctx), void *ctx) {
+    if (tree->root != NULL || tree->small != NULL) {
+        return false;
+    }
+
+    _unreserve(tree);
+    tree->node_alloc = node_alloc;
+    tree->node_free = node_free;
+    tree->allocator = ctx;
+    return true;
+}
+
+bool bt_is_balanced(bt_Tree *tree) { return _is_balanced(tree->root); }
+
+void bt_balance(bt_Tree *tree) {
+    if (tree->balance != TREAP_BALANCE) {
+        _balance(tree, &tree->root);
+    }
+}
+
+bool bt_balance_step(bt_Tree *tree, size_t max_work) {
+    if (tree->balance == TREAP_BALANCE) {
+        return true;
+    }
+
+    // the ancestors of a joined subtree keep their dirty mark and stale heights until the walk
+    // climbs back to them, any dirty node without dirty children is joined
+    size_t work = 0;
+    bt_Node *node = tree->balance_cursor;
+    do {
+        if (node == NULL) {
+            if (tree->root == NULL || !tree->root->dirty) {
+                tree->balance_cursor = NULL;
+                return true;
+            }
+            node = tree->root;
+        }
+
+        work += 1;
+        if (!node->dirty) {
+            node = node->parent;
+        } else if (node->left != NULL && node->left->dirty) {
+            node = node->left;
+        } else if (node->right != NULL && node->right->dirty) {
+            node = node->right;
+        } else {
+            bt_Node *parent = node->parent;
+            bt_Node **link = _link_of(tree, node);
+            bt_Node *left;
+            bt_Node *right;
+            size_t left_depth = _depth_at(node->left);
+            size_t right_depth = _depth_at(node->right);
+            work += left_depth > right_depth ? left_depth - right_depth : right_depth - left_depth;
+            _expose(node, &left, &right);
+            *link = _join(tree, left, node, right);
+            (*link)->parent = parent;
+            node = parent;
+        }
+    } while (work < max_work);
+
+    tree->balance_cursor = node;
+    return tree->root == NULL || !tree->root->dirty;
+}
+
+void bt_compact(bt_Tree *tree) {
+    _compact_reset(tree);
+    bt_compact_step(tree, SIZE_MAX);
+}
+
+bool bt_compact_step(bt_Tree *tree, size_t max_work) {
+    if (tree->small != NULL) {
+        // a block holds its nodes in order already
+        return true;
+    }
+    bt_Node *node = tree->compact_cursor != NULL ? tree->compact_cursor : bt_first(tree);
+    size_t work;
+    for (work = 0; node != NULL && work < max_work; work++) {
+        bt_Node *moved = _relocate(tree, node);
+        if (moved == NULL) {
+            // out of memory, the node stays where it is and the next call tries again
+            break;
+        }
+        node = bt_next(moved);
+    }
+
+    if (node == NULL) {
+        _compact_reset(tree);
+        return true;
+    }
+    tree->compact_cursor = node;
+    return false;
+}
 
 void bt_print(bt_Tree *tree, void (*to_str)(void *, char *)) {
-    _print(tree->root, to_str, 0);
-    printf("\n");
+    fflush(stdout);
+    bt_dump(tree, to_str, bt_write_file, stdout);
+}
+
+bool bt_dump(bt_Tree *tree, void (*to_str)(void *, char *),
+             bool (*writer)(const char *buffer, size_t len, void *ctx), void *ctx) {
+    bt_Dump dump;
+    dump.len = 0;
+    dump.writer = writer;
+    dump.ctx = ctx;
+    dump.ok = true;
+
+    // in order walk keeping track of the level instead of recursing
+    bt_Node *node = tree->root;
+    size_t level = 0;
+    while (node != NULL && node->left != NULL) {
+        node = node->left;
+        level++;
+    }
+
+    while (node != NULL && dump.ok) {
+        _dump_node(&dump, node, to_str, level);
+
+        if (node->right != NULL) {
+            node = node->right;
+            level++;
+            while (node->left != NULL) {
+                node = node->left;
+                level++;
+            }
+            continue;
+        }
+        while (node->parent != NULL && node->parent->right == node) {
+            node = node->parent;
+            level--;
+        }
+        node = node->parent;
+        level--;
+    }
+
+    _dump_put(&dump, "\n", 1);
+    if (dump.ok && dump.len > 0) {
+        dump.ok = writer(dump.buffer, dump.len, ctx);
+    }
+    return dump.ok;
 }
 
+bool bt_write_file(const char *buffer, size_t len, void *ctx) {
+    FILE *file = (FILE *)ctx;
+    return fwrite(buffer, 1, len, file) == len && fflush(file) == 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+bool bt_write_fd(const char *buffer, size_t len, void *ctx) {
+    int fd = *(int *)ctx;
+    while (len > 0) {
+        ssize_t written = write(fd, buffer, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+#endif
+
 void bt_print_int(bt_Tree *tree) { bt_print(tree, _int_to_str); }
 
 void bt_print_float(bt_Tree *tree) { bt_print(tree, _float_to_str); }
 
 void bt_delete(bt_Tree *tree) { _delete(tree); }
 
-void BT_TRIVIAL_DELETE(void *data) { free(data); }
-void BT_NO_DELETE(void *data) {}
-// helper methods implementation
+void BT_TRIVIAL_DELETE(void *data) { free(data); }
+void BT_NO_DELETE(void *data) { (void)data; }
+// helper methods implementation
+
+static int _cmp_int(void *d1, void *d2) {
+    int i1 = *((int *)d1);
+    int i2 = *((int *)d2);
+
+    if (i1 < i2) {
+        return -1;
+    } else if (i1 == i2) {
+        return 0;
+    } else {
+        return 1;
+    }
+}
+
+static int _cmp_float(void *d1, void *d2) {
+    float f1 = *((float *)d1);
+    float f2 = *((float *)d2);
+
+    if (f1 - f2 > 0.0001) {
+        return -1;
+    } else if (f1 - f2 < 0.0001 && f1 - f2 > -0.0001) {
+        return 0;
+    } else {
+        return 1;
+    }
+}
+
+static void _int_to_str(void *data, char *str) { sprintf(str, "%d", *(int *)data); }
+
+static void _float_to_str(void *data, char *str) { sprintf(str, "%f", *(float *)data); }
+
+static bt_Status _add(bt_Tree *tree, void *data, void *value, bt_Node **at) {
+    _settle(tree);
+    if (tree->small != NULL && tree->count == tree->small_max && !_promote(tree)) {
+        *at = NULL;
+        return BT_ENOMEM;
+    }
+
+    bt_Node **node = &tree->root;
+    bt_Node *parent = NULL;
+    uint64_t prefix = _prefix(tree, data);
+    if (tree->finger && tree->finger_node != NULL) {
+        node = _finger_link(tree, data, prefix);
+        parent = (*node)->parent;
+    }
+    while (*node != NULL) {
+        int cmp_result = _compare(tree, data, prefix, *node);
+
+        if (cmp_result == 0) {
+            *at = *node;
+            if (tree->small == NULL) {
+                tree->finger_node = *node;
+            }
+            return BT_EXISTS;
+        }
+
+        parent = *node;
+        if (cmp_result <= -1) {
+            node = &parent->left;
+        } else {
+            node = &parent->right;
+        }
+    }
+
+    bt_Node *nod;
+    if (_small_open(tree)) {
+        nod = _small_insert(tree, parent, parent != NULL && node == &parent->right);
+    } else {
+        nod = _alloc_node(tree);
+        if (nod == NULL) {
+            *at = NULL;
+            return BT_ENOMEM;
+        }
+        *node = nod;
+    }
+    if (tree->key_size == 0) {
+        nod->data = data;
+    } else {
+        nod->data = _field(tree, nod, BT_LAYOUT_KEY);
+        memcpy(nod->data, data, tree->key_size);
+    }
+    if (tree->layout & BT_LAYOUT_VALUE) {
+        *bt_node_value(nod) = value;
+    }
+    if (tree->layout & BT_LAYOUT_PRIORITY) {
+        *(unsigned int *)_field(tree, nod, BT_LAYOUT_PRIORITY) = _random(tree);
+    }
+    _store_prefix(tree, nod, prefix);
+    nod->left = NULL;
+    nod->right = NULL;
+    nod->parent = parent;
+    nod->size = 1;
+    nod->height = 1;
+    nod->multiplicity = 1;
+    nod->compacted = 0;
+    _filter_update(tree, nod->data, 1);
+    if (tree->small != NULL) {
+        tree->root = _small_link(tree, 0, tree->count + 1, NULL);
+    } else {
+        _update_path(tree, nod);
+    }
+    if (tree->balance == TREAP_BALANCE) {
+        _bubble(tree, nod);
+    }
+    // nodes in a block move with every add
+    tree->finger_node = tree->small == NULL ? nod : NULL;
+    *at = nod;
+    return BT_OK;
+}
+
+static bt_Tree *_create_like(bt_Tree *tree) {
+    bt_Tree *created = bt_create(tree->compare, tree->delete);
+    if (created == NULL) {
+        return NULL;
+    }
+    created->multiset = tree->multiset;
+    created->map = tree->map;
+    created->layout = tree->layout;
+    created->key_size = tree->key_size;
+    created->low = tree->low;
+    created->high = tree->high;
+    created->compare_point = tree->compare_point;
+    created->aggregate_size = tree->aggregate_size;
+    created->lift = tree->lift;
+    created->combine = tree->combine;
+    created->identity = tree->identity;
+    created->normalize = tree->normalize;
+    created->hash = tree->hash;
+    created->balance = tree->balance;
+    created->rng = _random(tree);
+    created->node_alloc = tree->node_alloc;
+    created->node_free = tree->node_free;
+    created->allocator = tree->allocator;
+    created->small_max = tree->small_max;
+    created->finger = tree->finger;
+    if (tree->filter != NULL) {
+        created->filter = (uint8_t *)calloc(tree->filter_size, sizeof(uint8_t));
+        created->filter_size = tree->filter_size;
+        if (created->filter == NULL) {
+            bt_delete(created);
+            return NULL;
+        }
+    }
+    return created;
+}
+
+// trees whose nodes can be moved into each other
+static bool _compatible(bt_Tree *tree, bt_Tree *other) {
+    _settle(tree);
+    _settle(other);
+    return tree->compare == other->compare && tree->layout == other->layout &&
+           tree->key_size == other->key_size &&
+           tree->aggregate_size == other->aggregate_size && tree->normalize == other->normalize &&
+           tree->node_alloc == other->node_alloc && tree->allocator == other->allocator;
+}
+
+static bt_Node *_alloc_node(bt_Tree *tree) {
+    if (tree->reserve != NULL) {
+        bt_Node *node = tree->reserve;
+        tree->reserve = node->right;
+        tree->reserved -= 1;
+        return node;
+    }
+    size_t size = _node_size(tree);
+    if (tree->node_alloc != NULL) {
+        return (bt_Node *)tree->node_alloc(size, tree->allocator);
+    }
+    return (bt_Node *)malloc(size);
+}
+
+// fixes the fields stored behind the nodes by the enabled modes while the tree holds no nodes
+static void _settle(bt_Tree *tree) {
+    if (tree->root != NULL || tree->small != NULL || tree->reserve != NULL) {
+        return;
+    }
+    tree->layout = 0;
+    if (tree->map) {
+        tree->layout |= BT_LAYOUT_VALUE;
+    }
+    if (tree->high != NULL) {
+        tree->layout |= BT_LAYOUT_HIGH;
+    }
+    if (tree->normalize != NULL) {
+        tree->layout |= BT_LAYOUT_PREFIX;
+    }
+    if (tree->balance == TREAP_BALANCE) {
+        tree->layout |= BT_LAYOUT_PRIORITY;
+    }
+}
+
+// offset of field from the end of a node, counting the fields stored before it
+static size_t _trailer(bt_Tree *tree, unsigned int field) {
+    size_t offset = 0;
+    if (field > BT_LAYOUT_VALUE && (tree->layout & BT_LAYOUT_VALUE)) {
+        offset += sizeof(void *);
+    }
+    if (field > BT_LAYOUT_AGGREGATE) {
+        // padded, so the words and inline keys behind the aggregate stay aligned
+        offset += (tree->aggregate_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    }
+    if (field > BT_LAYOUT_HIGH && (tree->layout & BT_LAYOUT_HIGH)) {
+        offset += sizeof(void *);
+    }
+    if (field > BT_LAYOUT_PREFIX && (tree->layout & BT_LAYOUT_PREFIX)) {
+        offset += sizeof(uint64_t);
+    }
+    if (field > BT_LAYOUT_PRIORITY && (tree->layout & BT_LAYOUT_PRIORITY)) {
+        // a whole word keeps inline keys aligned
+        offset += sizeof(uint64_t);
+    }
+    return offset;
+}
+
+static size_t _node_size(bt_Tree *tree) {
+    return sizeof(bt_Node) + _trailer(tree, BT_LAYOUT_KEY) + tree->key_size;
+}
+
+static void *_field(bt_Tree *tree, bt_Node *node, unsigned int field) {
+    return (char *)(node + 1) + _trailer(tree, field);
+}
+
+static void **_max_high(bt_Tree *tree, bt_Node *node) {
+    return (void **)_field(tree, node, BT_LAYOUT_HIGH);
+}
+
+static uint64_t _node_prefix(bt_Tree *tree, bt_Node *node) {
+    if ((tree->layout & BT_LAYOUT_PREFIX) == 0) {
+        return 0;
+    }
+    return *(uint64_t *)_field(tree, node, BT_LAYOUT_PREFIX);
+}
+
+static void _store_prefix(bt_Tree *tree, bt_Node *node, uint64_t prefix) {
+    if (tree->layout & BT_LAYOUT_PREFIX) {
+        *(uint64_t *)_field(tree, node, BT_LAYOUT_PREFIX) = prefix;
+    }
+}
+
+// priority of node in a treap, 0 for nodes without one
+static unsigned int _priority(bt_Tree *tree, bt_Node *node) {
+    if ((tree->layout & BT_LAYOUT_PRIORITY) == 0) {
+        return 0;
+    }
+    return *(unsigned int *)_field(tree, node, BT_LAYOUT_PRIORITY);
+}
+
+static void _free_node(bt_Tree *tree, bt_Node *node) {
+    if (node->compacted) {
+        // regions are aligned to their size, so the header is found from any of its nodes
+        struct bt_Region *region =
+            (struct bt_Region *)((uintptr_t)node & ~(uintptr_t)(BT_COMPACT_REGION - 1));
+        region->live -= 1;
+        if (region->live == 0 && !region->filling) {
+            free(region);
+        }
+    } else if (tree->node_alloc != NULL) {
+        tree->node_free(node, tree->allocator);
+    } else {
+        free(node);
+    }
+}
+
+// frees the nodes reserved by bt_reserve
+static void _unreserve(bt_Tree *tree) {
+    while (tree->reserve != NULL) {
+        bt_Node *node = tree->reserve;
+        tree->reserve = node->right;
+        _free_node(tree, node);
+    }
+    tree->reserved = 0;
+}
+
+// unlinks and frees the node link points to
+static void _remove(bt_Tree *tree, bt_Node **link) {
+    bt_Node *node = *link;
+    _filter_update(tree, node->data, -1);
+    if (tree->finger_node == node) {
+        tree->finger_node = NULL;
+    }
+    if (tree->balance_cursor == node) {
+        tree->balance_cursor = NULL;
+    }
+    bt_Node *changed = NULL;
+    if (tree->small != NULL) {
+        _small_remove(tree, node);
+    } else {
+        if (tree->compact_cursor == node) {
+            tree->compact_cursor = bt_next(node);
+        }
+        changed = _unlink(_sink(tree, link));
+        _update_path(tree, changed);
+        _free_node(tree, node);
+    }
+    tree->count -= 1;
+    _rebalance(tree, changed, false);
+    _demote(tree);
+}
+
+// distance of the nodes in a block, keeping them aligned like malloc does
+static size_t _small_stride(bt_Tree *tree) {
+    size_t size = _node_size(tree);
+    return (size + 15) & ~(size_t)15;
+}
+
+// tells if the next node of tree goes into a block, allocating it for the first node
+static bool _small_open(bt_Tree *tree) {
+    if (tree->small == NULL && tree->root == NULL && tree->small_max > 0 &&
+        tree->balance != TREAP_BALANCE && tree->reserve == NULL) {
+        // without a block the nodes are allocated one by one
+        tree->small = _small_alloc(tree);
+    }
+    return tree->small != NULL;
+}
+
+// allocates a block for small_max nodes like the nodes are allocated
+static bt_Node *_small_alloc(bt_Tree *tree) {
+    size_t size = tree->small_max * _small_stride(tree);
+    if (tree->node_alloc != NULL) {
+        return (bt_Node *)tree->node_alloc(size, tree->allocator);
+    }
+    return (bt_Node *)malloc(size);
+}
+
+static void _small_free(bt_Tree *tree) {
+    if (tree->small != NULL && tree->node_free != NULL) {
+        tree->node_free(tree->small, tree->allocator);
+    } else {
+        free(tree->small);
+    }
+    tree->small = NULL;
+}
+
+// makes room in the block for a node right of or left of parent and returns its slot
+static bt_Node *_small_insert(bt_Tree *tree, bt_Node *parent, bool right) {
+    size_t stride = _small_stride(tree);
+    char *block = (char *)tree->small;
+    size_t idx = 0;
+    if (parent != NULL) {
+        idx = (size_t)((char *)parent - block) / stride + (right ? 1 : 0);
+    }
+    char *slot = block + idx * stride;
+    memmove(slot + stride, slot, (tree->count - idx) * stride);
+    return (bt_Node *)slot;
+}
+
+// closes the gap node leaves in the block, freeing the block with the last node
+static void _small_remove(bt_Tree *tree, bt_Node *node) {
+    size_t stride = _small_stride(tree);
+    char *slot = (char *)node;
+    char *end = (char *)tree->small + tree->count * stride;
+    memmove(slot, slot + stride, (size_t)(end - slot) - stride);
+    if (tree->count == 1) {
+        _small_free(tree);
+        tree->root = NULL;
+    } else {
+        tree->root = _small_link(tree, 0, tree->count - 1, NULL);
+    }
+}
+
+// links the nodes in the slots lo to hi - 1 of the block into a perfectly balanced subtree
+static bt_Node *_small_link(bt_Tree *tree, size_t lo, size_t hi, bt_Node *parent) {
+    if (lo == hi) {
+        return NULL;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    bt_Node *node = (bt_Node *)((char *)tree->small + mid * _small_stride(tree));
+    node->parent = parent;
+    if (tree->key_size > 0) {
+        node->data = _field(tree, node, BT_LAYOUT_KEY);
+    }
+    node->left = _small_link(tree, lo, mid, node);
+    node->right = _small_link(tree, mid + 1, hi, node);
+    _update(tree, node);
+    return node;
+}
+
+// moves the nodes of the block of tree into allocations of their own
+static bool _promote(bt_Tree *tree) {
+    if (tree->small == NULL) {
+        return true;
+    }
+
+    size_t size = _node_size(tree);
+    bt_Node *list = NULL;
+    size_t idx;
+    for (idx = tree->count; idx > 0; idx--) {
+        bt_Node *node = _alloc_node(tree);
+        if (node == NULL) {
+            while (list != NULL) {
+                node = list;
+                list = node->right;
+                _free_node(tree, node);
+            }
+            return false;
+        }
+        memcpy(node, (char *)tree->small + (idx - 1) * _small_stride(tree), size);
+        if (tree->key_size > 0) {
+            node->data = _field(tree, node, BT_LAYOUT_KEY);
+        }
+        node->right = list;
+        list = node;
+    }
+
+    _small_free(tree);
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    tree->root = _build(tree, tree->count, &list);
+    tree->max_count = tree->count;
+    return true;
+}
+
+// moves the nodes of tree into a block once it shrank to half of small_max
+static void _demote(bt_Tree *tree) {
+    if (tree->small != NULL || tree->count == 0 || tree->count > tree->small_max / 2 ||
+        tree->balance == TREAP_BALANCE || tree->reserve != NULL) {
+        return;
+    }
+    size_t stride = _small_stride(tree);
+    char *block = (char *)_small_alloc(tree);
+    if (block == NULL) {
+        return;
+    }
+
+    size_t size = _node_size(tree);
+    char *slot = block;
+    bt_Node *node;
+    for (node = bt_first(tree); node != NULL; node = bt_next(node)) {
+        memcpy(slot, node, size);
+        ((bt_Node *)slot)->compacted = 0;
+        slot += stride;
+    }
+    // successors are found through parents, so the nodes are freed after copying all of them
+    bt_Node *next;
+    for (node = bt_walk_first(tree, POST_ORDER); node != NULL; node = next) {
+        next = bt_walk_next(node, POST_ORDER);
+        _free_node(tree, node);
+    }
+    _compact_reset(tree);
+    tree->finger_node = NULL;
+    tree->balance_cursor = NULL;
+    tree->small = (bt_Node *)block;
+    tree->root = _small_link(tree, 0, tree->count, NULL);
+}
+
+// moves node to the next slot of the region being filled and returns its new address or NULL if
+// memory ran out
+static bt_Node *_relocate(bt_Tree *tree, bt_Node *node) {
+    size_t size = _node_size(tree);
+    bt_Node *moved;
+    if (tree->node_alloc != NULL) {
+        moved = (bt_Node *)tree->node_alloc(size, tree->allocator);
+        if (moved == NULL) {
+            return NULL;
+        }
+        memcpy(moved, node, size);
+        moved->compacted = 0;
+    } else {
+        size_t head = (sizeof(struct bt_Region) + 15) & ~(size_t)15;
+        size_t stride = (size + 15) & ~(size_t)15;
+        struct bt_Region *region = tree->compact_region;
+        if (region == NULL || region->used + stride > BT_COMPACT_REGION) {
+            _region_close(tree);
+            region = (struct bt_Region *)aligned_alloc(BT_COMPACT_REGION, BT_COMPACT_REGION);
+            if (region == NULL) {
+                return NULL;
+            }
+            region->live = 0;
+            region->used = head;
+            region->filling = true;
+            tree->compact_region = region;
+        }
+        moved = (bt_Node *)((char *)region + region->used);
+        region->used += stride;
+        region->live += 1;
+        memcpy(moved, node, size);
+        moved->compacted = 1;
+    }
+
+    *_link_of(tree, node) = moved;
+    if (tree->finger_node == node) {
+        tree->finger_node = moved;
+    }
+    if (tree->balance_cursor == node) {
+        tree->balance_cursor = moved;
+    }
+    if (moved->left != NULL) {
+        moved->left->parent = moved;
+    }
+    if (moved->right != NULL) {
+        moved->right->parent = moved;
+    }
+    if (tree->key_size > 0) {
+        moved->data = _field(tree, moved, BT_LAYOUT_KEY);
+        // greatest high endpoints may point into the inline key of node
+        if (tree->layout & BT_LAYOUT_HIGH) {
+            _update_path(tree, moved);
+        }
+    }
+    _free_node(tree, node);
+    return moved;
+}
+
+// stops filling the region of tree, freeing it if none of its nodes is left
+static void _region_close(bt_Tree *tree) {
+    struct bt_Region *region = tree->compact_region;
+    if (region != NULL) {
+        region->filling = false;
+        if (region->live == 0) {
+            free(region);
+        }
+    }
+    tree->compact_region = NULL;
+}
+
+// stops compacting tree, the next step starts a new pass with a new region
+static void _compact_reset(bt_Tree *tree) {
+    _region_close(tree);
+    tree->compact_cursor = NULL;
+}
+
+// hands the data or value owned by node to the delete function of tree
+static void _release(bt_Tree *tree, bt_Node *node) {
+    if (tree->map) {
+        if (*bt_node_value(node) != NULL) {
+            tree->delete (*bt_node_value(node));
+        }
+    } else if (tree->key_size == 0 && node->data != NULL) {
+        tree->delete (node->data);
+    }
+}
+
+static bt_Node *_unlink(bt_Node **link) {
+    bt_Node *node = *link;
+    bt_Node *changed = node->parent;
+    if (node->left == NULL) {
+        *link = node->right;
+    } else if (node->right == NULL) {
+        *link = node->left;
+    } else {
+        // splice the in-order predecessor into the place of node
+        bt_Node **pred_link = &node->left;
+        while ((*pred_link)->right != NULL) {
+            pred_link = &(*pred_link)->right;
+        }
+        bt_Node *pred = *pred_link;
+        changed = pred->parent == node ? pred : pred->parent;
+        *pred_link = pred->left;
+        if (pred->left != NULL) {
+            pred->left->parent = pred->parent;
+        }
+        pred->left = node->left;
+        pred->right = node->right;
+        if (pred->left != NULL) {
+            pred->left->parent = pred;
+        }
+        pred->right->parent = pred;
+        *link = pred;
+    }
+
+    if (*link != NULL) {
+        (*link)->parent = node->parent;
+    }
+    return changed;
+}
+
+static void _update(bt_Tree *tree, bt_Node *node) {
+    size_t left_depth = _depth_at(node->left);
+    size_t right_depth = _depth_at(node->right);
+    node->height = (unsigned int)bt_max(left_depth, right_depth) + 1;
+    node->dirty = left_depth > right_depth + 1 || right_depth > left_depth + 1 ||
+                  (node->left != NULL && node->left->dirty) ||
+                  (node->right != NULL && node->right->dirty);
+    node->size = 1;
+    if (node->left != NULL) {
+        node->size += node->left->size;
+    }
+    if (node->right != NULL) {
+        node->size += node->right->size;
+    }
+
+    if (tree->layout & BT_LAYOUT_HIGH) {
+        void **max_high = _max_high(tree, node);
+        *max_high = tree->high(node->data);
+        if (node->left != NULL &&
+            tree->compare_point(*_max_high(tree, node->left), *max_high) >= 1) {
+            *max_high = *_max_high(tree, node->left);
+        }
+        if (node->right != NULL &&
+            tree->compare_point(*_max_high(tree, node->right), *max_high) >= 1) {
+            *max_high = *_max_high(tree, node->right);
+        }
+    }
 
-static int _cmp_int(void *d1, void *d2) {
-    int i1 = *((int *)d1);
-    int i2 = *((int *)d2);
+    if (tree->aggregate_size > 0) {
+        void *aggregate = bt_node_aggregate(tree, node);
+        tree->lift(node, aggregate);
+        if (node->left != NULL) {
+            tree->combine(aggregate, bt_node_aggregate(tree, node->left), aggregate);
+        }
+        if (node->right != NULL) {
+            tree->combine(aggregate, aggregate, bt_node_aggregate(tree, node->right));
+        }
+    }
+}
 
-    if (i1 < i2) {
-        return -1;
-    } else if (i1 == i2) {
-        return 0;
-    } else {
-        return 1;
+static void _update_path(bt_Tree *tree, bt_Node *node) {
+    while (node != NULL) {
+        _update(tree, node);
+        node = node->parent;
     }
 }
 
-static int _cmp_float(void *d1, void *d2) {
-    float f1 = *((float *)d1);
-    float f2 = *((float *)d2);
+// recomputes the augmentations depending on the payload of node after it changed
+static void _refresh(bt_Tree *tree, bt_Node *node) {
+    if ((tree->layout & BT_LAYOUT_HIGH) || tree->aggregate_size > 0) {
+        _update_path(tree, node);
+    }
+}
 
-    if (f1 - f2 > 0.0001) {
-        return -1;
-    } else if (f1 - f2 < 0.0001 && f1 - f2 > -0.0001) {
-        return 0;
+static bt_Node **_link_of(bt_Tree *tree, bt_Node *node) {
+    if (node->parent == NULL) {
+        return &tree->root;
+    } else if (node->parent->left == node) {
+        return &node->parent->left;
     } else {
-        return 1;
+        return &node->parent->right;
     }
 }
 
-static void _int_to_str(void *data, char *str) { sprintf(str, "%d", *(int *)data); }
-
-static void _float_to_str(void *data, char *str) { sprintf(str, "%f", *(float *)data); }
-
-static int _add(bt_Node **node, bt_Node *parent, void *data, int (*compare)(void *d1, void *d2)) {
-    if (*node == NULL) {
-        *node = (bt_Node *)malloc(sizeof(bt_Node));
-        bt_Node *nod = *node;
-        nod->data = data;
-        nod->left = NULL;
-        nod->right = NULL;
-        return 1;
+static bt_Node *_bound(bt_Tree *tree, void *data, int limit) {
+    bt_Node *node = tree->root;
+    bt_Node *bound = NULL;
+    uint64_t prefix = _prefix(tree, data);
+    while (node != NULL) {
+        if (_compare(tree, data, prefix, node) <= limit) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
     }
+    return bound;
+}
 
-    int cmp_result = compare(data, (*node)->data);
-
-    if (cmp_result <= -1) {
-        return _add(&(*node)->left, parent, data, compare);
-    } else if (cmp_result >= 1) {
-        return _add(&(*node)->right, parent, data, compare);
-    } else {
+static uint64_t _prefix(bt_Tree *tree, void *data) {
+    if ((tree->layout & BT_LAYOUT_PREFIX) == 0) {
         return 0;
     }
+    return tree->normalize(data);
 }
 
-static void _clear(bt_Node **root) {
-    bt_Node *node = *root;
-    if (node->left != NULL) {
-        node->data = node->left->data;
-        _clear(&node->left);
-    } else if (node->right != NULL) {
-        node->data = node->right->data;
-        _clear(&node->right);
-    } else {
-        free(node);
-        *root = NULL;
+// compares data to the data of node, resolving by the cached prefixes where possible
+static int _compare(bt_Tree *tree, void *data, uint64_t prefix, bt_Node *node) {
+    if (tree->layout & BT_LAYOUT_PREFIX) {
+        uint64_t node_prefix = *(uint64_t *)_field(tree, node, BT_LAYOUT_PREFIX);
+        if (prefix < node_prefix) {
+            return -1;
+        } else if (prefix > node_prefix) {
+            return 1;
+        }
     }
+    return tree->compare(data, node->data);
 }
-static int _remove(bt_Node **node, void *data, int (*compare)(void *d1, void *d2)) {
-    if (*node == NULL) {
-        return 0;
+
+static bt_Node *_leftmost(bt_Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+static bt_Node *_rightmost(bt_Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->right != NULL) {
+        node = node->right;
     }
+    return node;
+}
 
-    int cmp_result = compare(data, (*node)->data);
+static bt_Node **_find_link(bt_Tree *tree, void *data) {
+    bt_Node **node = &tree->root;
+    uint64_t prefix = _prefix(tree, data);
+    while (*node != NULL) {
+        int cmp_result = _compare(tree, data, prefix, *node);
 
-    if (cmp_result == 0) {
-        _clear(node);
-        return 1;
-    } else if (cmp_result <= -1) {
-        return _remove(&(*node)->left, data, compare);
-    } else {
-        return _remove(&(*node)->right, data, compare);
+        if (cmp_result == 0) {
+            break;
+        } else if (cmp_result <= -1) {
+            node = &(*node)->left;
+        } else {
+            node = &(*node)->right;
+        }
+    }
+    return node;
+}
+
+// climbs from the finger to the node whose subtree holds the place of data and returns its link
+static bt_Node **_finger_link(bt_Tree *tree, void *data, uint64_t prefix) {
+    bt_Node *node = tree->finger_node;
+    int side = _compare(tree, data, prefix, node);
+    while (side != 0) {
+        // the place lies between node and the nearest ancestor on the side of data unless data is
+        // beyond that ancestor, the ancestors passed on the way are on the other side
+        bt_Node *child = node;
+        bt_Node *bound = node->parent;
+        while (bound != NULL && (side > 0 ? bound->right : bound->left) == child) {
+            child = bound;
+            bound = bound->parent;
+        }
+        if (bound == NULL) {
+            break;
+        }
+        int cmp_result = _compare(tree, data, prefix, bound);
+        if (cmp_result != 0 && (cmp_result > 0) != (side > 0)) {
+            break;
+        }
+        node = bound;
+        if (cmp_result == 0) {
+            break;
+        }
     }
+    return _link_of(tree, node);
 }
 
 static int _traverse(bt_Node *node, TraversalStrategy strategy, bt_Node **array, size_t idx) {
@@ -411,22 +2580,20 @@ static int _traverse(bt_Node *node, TraversalStrategy strategy, bt_Node **array,
     return idx;
 }
 
+// the first node of a post order traversal of the subtree at node
+static bt_Node *_post_first(bt_Node *node) {
+    while (node != NULL && (node->left != NULL || node->right != NULL)) {
+        node = node->left != NULL ? node->left : node->right;
+    }
+    return node;
+}
+
 static size_t _depth_at(bt_Node *node) {
     if (node == NULL) {
         return 0;
     }
 
-    size_t left_depth = 0;
-    if (node->left != NULL) {
-        left_depth = _depth_at(node->left);
-    }
-
-    size_t right_depth = 0;
-    if (node->right != NULL) {
-        right_depth = _depth_at(node->right);
-    }
-
-    return bt_max(left_depth, right_depth) + 1;
+    return node->height;
 }
 
 static bool _is_balanced(bt_Node *node) {
@@ -448,14 +2615,17 @@ static bool _is_balanced(bt_Node *node) {
            _is_balanced(node->right);
 }
 
-static void _balance(bt_Node **rootPtr) {
+static void _balance(bt_Tree *tree, bt_Node **rootPtr) {
     if (*rootPtr == NULL) {
         return;
     }
 
 #define HISTORY_LEN 5
-    size_t left_history[HISTORY_LEN] = {0};
-    size_t right_history[HISTORY_LEN] = {0};
+    // depths of the children seen before the last rotations, kept in a ring; seeing them again
+    // means the rotations cycle without balancing the root any further
+    int left_history[HISTORY_LEN];
+    int right_history[HISTORY_LEN];
+    size_t history_len = 0;
     size_t history_curr = 0;
 
     int left_depth;
@@ -474,28 +2644,204 @@ static void _balance(bt_Node **rootPtr) {
             right_depth = 0;
         }
 
-        if (left_history[0] == left_depth && right_history[0] == right_depth) {
+        size_t idx;
+        for (idx = 0; idx < history_len; idx++) {
+            if (left_history[idx] == left_depth && right_history[idx] == right_depth) {
+                break;
+            }
+        }
+        if (idx < history_len) {
             break;
         }
 
         if (right_depth > left_depth + 1) {
-            _rotate_left(rootPtr);
+            _rotate_left(tree, rootPtr);
         } else if (left_depth > right_depth + 1) {
-            _rotate_right(rootPtr);
+            _rotate_right(tree, rootPtr);
         } else {
             break;
         }
 
+        // (history_curr + 1) wraps around the ring, history_curr + 1 % HISTORY_LEN would not
         left_history[history_curr] = left_depth;
         right_history[history_curr] = right_depth;
-        history_curr = history_curr + 1 % HISTORY_LEN;
+        history_curr = (history_curr + 1) % HISTORY_LEN;
+        if (history_len < HISTORY_LEN) {
+            history_len++;
+        }
+    }
+#undef HISTORY_LEN
+
+    _balance(tree, &(*rootPtr)->left);
+    _balance(tree, &(*rootPtr)->right);
+    _update(tree, *rootPtr);
+}
+
+// restores the balance after node was added to tree or a remove changed the subtree at node (NULL
+// if the removed node was the root)
+static void _rebalance(bt_Tree *tree, bt_Node *node, bool added) {
+    if (tree->small != NULL) {
+        // blocks are linked perfectly balanced
+        return;
+    }
+    switch (tree->balance) {
+    case EAGER_BALANCE:
+        // a balanced tree only loses its balance on the path of node, a tree left unbalanced by
+        // another strategy is rebuilt once
+        _retrace(tree, node);
+        if (tree->root != NULL && tree->root->dirty) {
+            _rebuild(tree, &tree->root);
+        }
+        break;
+    case SCAPEGOAT_BALANCE:
+        _scapegoat(tree, added ? node : NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+// rotates the ancestors of node whose children differ in height by more than one, which keeps
+// adds to and removes from an AVL tree from touching more than their path
+static void _retrace(bt_Tree *tree, bt_Node *node) {
+    while (node != NULL) {
+        bt_Node **link = _link_of(tree, node);
+        size_t left_depth = _depth_at(node->left);
+        size_t right_depth = _depth_at(node->right);
+        if (left_depth > right_depth + 1) {
+            if (_depth_at(node->left->right) > _depth_at(node->left->left)) {
+                _rotate_left(tree, &node->left);
+            }
+            _rotate_right(tree, link);
+        } else if (right_depth > left_depth + 1) {
+            if (_depth_at(node->right->left) > _depth_at(node->right->right)) {
+                _rotate_right(tree, &node->right);
+            }
+            _rotate_left(tree, link);
+        } else {
+            _update(tree, node);
+        }
+        node = (*link)->parent;
+    }
+}
+
+static void _scapegoat(bt_Tree *tree, bt_Node *added) {
+    if (added == NULL) {
+        if (tree->count * 3 < tree->max_count * 2) {
+            _rebuild(tree, &tree->root);
+            tree->max_count = tree->count;
+        }
+        return;
+    }
+
+    tree->max_count = bt_max(tree->max_count, tree->count);
+
+    // a depth beyond log_3/2(count) implies an ancestor with a child holding over 2/3 of its nodes
+    size_t depth = 0;
+    bt_Node *node;
+    for (node = added->parent; node != NULL; node = node->parent) {
+        depth += 1;
+    }
+    size_t limit = 0;
+    size_t reach = 1;
+    while (reach < tree->count) {
+        reach += reach / 2 + 1;
+        limit += 1;
+    }
+    if (depth <= limit) {
+        return;
+    }
+
+    bt_Node *child = added;
+    for (node = added->parent; node != NULL; child = node, node = node->parent) {
+        if (child->size * 3 > node->size * 2) {
+            _rebuild(tree, _link_of(tree, node));
+            return;
+        }
+    }
+}
+
+// rotates node up in a treap until its parent has a greater priority
+static void _bubble(bt_Tree *tree, bt_Node *node) {
+    while (node->parent != NULL && _priority(tree, node->parent) < _priority(tree, node)) {
+        bt_Node **link = _link_of(tree, node->parent);
+        if (node->parent->left == node) {
+            _rotate_right(tree, link);
+        } else {
+            _rotate_left(tree, link);
+        }
+    }
+    _update_path(tree, node->parent);
+}
+
+// rotates the node at link down in a treap until it has at most one child, returns its new link
+static bt_Node **_sink(bt_Tree *tree, bt_Node **link) {
+    if (tree->balance != TREAP_BALANCE) {
+        return link;
+    }
+
+    bt_Node *node = *link;
+    while (node->left != NULL && node->right != NULL) {
+        if (_priority(tree, node->left) > _priority(tree, node->right)) {
+            _rotate_right(tree, link);
+            link = &(*link)->right;
+        } else {
+            _rotate_left(tree, link);
+            link = &(*link)->left;
+        }
+    }
+    return link;
+}
+
+// draws the next treap priority (splitmix64)
+static unsigned int _random(bt_Tree *tree) {
+    tree->rng += 0x9e3779b97f4a7c15ULL;
+    return (unsigned int)(_mix(tree->rng) >> 32);
+}
+
+// rebuilds the subtree at link into a perfectly balanced one, reusing its nodes
+static void _rebuild(bt_Tree *tree, bt_Node **link) {
+    bt_Node *subtree = *link;
+    if (subtree == NULL) {
+        return;
     }
 
-    _balance(&(*rootPtr)->left);
-    _balance(&(*rootPtr)->right);
+    // rotate the subtree into a list linked through right, then build the tree from the list
+    bt_Node *parent = subtree->parent;
+    size_t count = subtree->size;
+    bt_Node **vine = link;
+    while (*vine != NULL) {
+        bt_Node *node = *vine;
+        if (node->left != NULL) {
+            bt_Node *pivot = node->left;
+            node->left = pivot->right;
+            pivot->right = node;
+            *vine = pivot;
+        } else {
+            vine = &node->right;
+        }
+    }
+
+    bt_Node *list = *link;
+    *link = _build(tree, count, &list);
+    (*link)->parent = parent;
+    _update_path(tree, parent);
+}
+
+// builds a perfectly balanced tree from the first count nodes of list and advances list past them
+static bt_Node *_build(bt_Tree *tree, size_t count, bt_Node **list) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    bt_Node *left = _build(tree, (count - 1) / 2, list);
+    bt_Node *node = *list;
+    *list = node->right;
+    bt_Node *right = _build(tree, count - 1 - (count - 1) / 2, list);
+    return _make(tree, left, node, right);
 }
 
-static void _rotate_left(bt_Node **rootPtr) {
+static void _rotate_left(bt_Tree *tree, bt_Node **rootPtr) {
     if (*rootPtr == NULL) {
         return;
     }
@@ -505,64 +2851,425 @@ static void _rotate_left(bt_Node **rootPtr) {
     bt_Node *pivotChild = pivot->left;
 
     root->right = pivotChild;
+    if (pivotChild != NULL) {
+        pivotChild->parent = root;
+    }
     pivot->left = root;
+    pivot->parent = root->parent;
+    root->parent = pivot;
     *rootPtr = pivot;
+    _update(tree, root);
+    _update(tree, pivot);
 }
 
-static void _rotate_right(bt_Node **rootPtr) {
+static void _rotate_right(bt_Tree *tree, bt_Node **rootPtr) {
     bt_Node *root = *rootPtr;
     bt_Node *pivot = root->left;
     bt_Node *pivotChild = pivot->right;
 
     root->left = pivotChild;
+    if (pivotChild != NULL) {
+        pivotChild->parent = root;
+    }
     pivot->right = root;
+    pivot->parent = root->parent;
+    root->parent = pivot;
     *rootPtr = pivot;
+    _update(tree, root);
+    _update(tree, pivot);
+}
+
+static void _dump_put(bt_Dump *dump, const char *str, size_t len) {
+    while (len > 0 && dump->ok) {
+        if (dump->len == BT_DUMP_BUFFER) {
+            dump->ok = dump->writer(dump->buffer, dump->len, dump->ctx);
+            dump->len = 0;
+        }
+        size_t chunk = BT_DUMP_BUFFER - dump->len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(dump->buffer + dump->len, str, chunk);
+        dump->len += chunk;
+        str += chunk;
+        len -= chunk;
+    }
 }
 
-static void _print(bt_Node *node, void (*to_str)(void *data, char *str), int level) {
+static void _dump_node(bt_Dump *dump, bt_Node *node, void (*to_str)(void *, char *), size_t level) {
     enum { DATA_STR_LEN = 129 };
-    static char data_str[DATA_STR_LEN];
+    char data_str[DATA_STR_LEN];
+    static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+    _dump_put(dump, "\n", 1);
+    while (level > 0) {
+        size_t len = level < sizeof(tabs) - 1 ? level : sizeof(tabs) - 1;
+        _dump_put(dump, tabs, len);
+        level -= len;
+    }
+
+    memset(data_str, 0, DATA_STR_LEN);
+    to_str(node->data, data_str);
+    _dump_put(dump, data_str, strlen(data_str));
+}
+
+static bt_Node *_make(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right) {
+    node->left = left;
+    node->right = right;
+    node->parent = NULL;
+    if (left != NULL) {
+        left->parent = node;
+    }
+    if (right != NULL) {
+        right->parent = node;
+    }
+    _update(tree, node);
+    return node;
+}
+
+static void _expose(bt_Node *node, bt_Node **left, bt_Node **right) {
+    *left = node->left;
+    *right = node->right;
+    if (*left != NULL) {
+        (*left)->parent = NULL;
+    }
+    if (*right != NULL) {
+        (*right)->parent = NULL;
+    }
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+}
+
+static bt_Node *_join(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right) {
+    if (tree->balance == TREAP_BALANCE) {
+        return _join_treap(tree, left, node, right);
+    }
+
+    size_t left_depth = _depth_at(left);
+    size_t right_depth = _depth_at(right);
+
+    if (left_depth > right_depth + 1) {
+        return _join_right(tree, left, node, right);
+    } else if (right_depth > left_depth + 1) {
+        return _join_left(tree, left, node, right);
+    } else {
+        return _make(tree, left, node, right);
+    }
+}
+
+// descends the root with the greater priority until node outranks both sides
+static bt_Node *_join_treap(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right) {
+    bool over_left = left == NULL || _priority(tree, left) <= _priority(tree, node);
+    bool over_right = right == NULL || _priority(tree, right) <= _priority(tree, node);
+    if (over_left && over_right) {
+        return _make(tree, left, node, right);
+    }
+
+    bt_Node *inner;
+    bt_Node *outer;
+    if (right == NULL || (left != NULL && _priority(tree, left) > _priority(tree, right))) {
+        _expose(left, &outer, &inner);
+        return _make(tree, outer, left, _join_treap(tree, inner, node, right));
+    }
+    _expose(right, &inner, &outer);
+    return _make(tree, _join_treap(tree, left, node, inner), right, outer);
+}
+
+// descends the right spine of left until right fits next to it
+static bt_Node *_join_right(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right) {
+    bt_Node *inner;
+    bt_Node *outer;
+    _expose(left, &outer, &inner);
+
+    bt_Node *joined;
+    bt_Node *root;
+    if (_depth_at(inner) <= _depth_at(right) + 1) {
+        joined = _make(tree, inner, node, right);
+        if (_depth_at(joined) <= _depth_at(outer) + 1) {
+            return _make(tree, outer, left, joined);
+        }
+        _rotate_right(tree, &joined);
+        root = _make(tree, outer, left, joined);
+        _rotate_left(tree, &root);
+        return root;
+    }
+
+    joined = _join_right(tree, inner, node, right);
+    root = _make(tree, outer, left, joined);
+    if (_depth_at(joined) > _depth_at(outer) + 1) {
+        _rotate_left(tree, &root);
+    }
+    return root;
+}
+
+// descends the left spine of right until left fits next to it
+static bt_Node *_join_left(bt_Tree *tree, bt_Node *left, bt_Node *node, bt_Node *right) {
+    bt_Node *inner;
+    bt_Node *outer;
+    _expose(right, &inner, &outer);
+
+    bt_Node *joined;
+    bt_Node *root;
+    if (_depth_at(inner) <= _depth_at(left) + 1) {
+        joined = _make(tree, left, node, inner);
+        if (_depth_at(joined) <= _depth_at(outer) + 1) {
+            return _make(tree, joined, right, outer);
+        }
+        _rotate_left(tree, &joined);
+        root = _make(tree, joined, right, outer);
+        _rotate_right(tree, &root);
+        return root;
+    }
+
+    joined = _join_left(tree, left, node, inner);
+    root = _make(tree, joined, right, outer);
+    if (_depth_at(joined) > _depth_at(outer) + 1) {
+        _rotate_right(tree, &root);
+    }
+    return root;
+}
+
+static bt_Node *_join2(bt_Tree *tree, bt_Node *left, bt_Node *right) {
+    if (left == NULL) {
+        return right;
+    }
+    if (right == NULL) {
+        return left;
+    }
+
+    bt_Node *last;
+    left = _split_last(tree, left, &last);
+    return _join(tree, left, last, right);
+}
+
+static bt_Node *_split_last(bt_Tree *tree, bt_Node *node, bt_Node **last) {
+    bt_Node *left;
+    bt_Node *right;
+    _expose(node, &left, &right);
+
+    if (right == NULL) {
+        *last = node;
+        return left;
+    }
+    return _join(tree, left, node, _split_last(tree, right, last));
+}
+
+static bt_Node *_split(bt_Tree *tree, bt_Node *node, void *data, uint64_t prefix, bt_Node **lt,
+                       bt_Node **gt) {
+    if (node == NULL) {
+        *lt = NULL;
+        *gt = NULL;
+        return NULL;
+    }
+
+    bt_Node *left;
+    bt_Node *right;
+    bt_Node *found;
+    bt_Node *rest;
+    _expose(node, &left, &right);
+
+    int cmp_result = _compare(tree, data, prefix, node);
+
+    if (cmp_result == 0) {
+        *lt = left;
+        *gt = right;
+        _update(tree, node);
+        return node;
+    } else if (cmp_result <= -1) {
+        found = _split(tree, left, data, prefix, lt, &rest);
+        *gt = _join(tree, rest, node, right);
+    } else {
+        found = _split(tree, right, data, prefix, &rest, gt);
+        *lt = _join(tree, left, node, rest);
+    }
+    return found;
+}
+
+static bt_Node *_union(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node) {
+    if (node == NULL) {
+        return other_node;
+    }
+    if (other_node == NULL) {
+        return node;
+    }
+
+    bt_Node *left;
+    bt_Node *right;
+    bt_Node *other_left;
+    bt_Node *other_right;
+    _expose(node, &left, &right);
+    bt_Node *found = _split(tree, other_node, node->data, _node_prefix(tree, node), &other_left, &other_right);
+    if (found != NULL) {
+        if (tree->multiset) {
+            node->multiplicity += found->multiplicity;
+        }
+        _discard(other, found);
+    }
+
+    left = _union(tree, left, other, other_left);
+    right = _union(tree, right, other, other_right);
+    return _join(tree, left, node, right);
+}
+
+static bt_Node *_intersect(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node) {
+    if (node == NULL || other_node == NULL) {
+        _discard(tree, node);
+        _discard(other, other_node);
+        return NULL;
+    }
+
+    bt_Node *left;
+    bt_Node *right;
+    bt_Node *other_left;
+    bt_Node *other_right;
+    _expose(node, &left, &right);
+    bt_Node *found = _split(tree, other_node, node->data, _node_prefix(tree, node), &other_left, &other_right);
+
+    left = _intersect(tree, left, other, other_left);
+    right = _intersect(tree, right, other, other_right);
+    if (found != NULL) {
+        if (tree->multiset && found->multiplicity < node->multiplicity) {
+            node->multiplicity = found->multiplicity;
+        }
+        _discard(other, found);
+        return _join(tree, left, node, right);
+    }
+    _discard(tree, node);
+    return _join2(tree, left, right);
+}
+
+static bt_Node *_difference(bt_Tree *tree, bt_Node *node, bt_Tree *other, bt_Node *other_node) {
+    if (node == NULL || other_node == NULL) {
+        _discard(other, other_node);
+        return node;
+    }
+
+    bt_Node *left;
+    bt_Node *right;
+    bt_Node *other_left;
+    bt_Node *other_right;
+    _expose(node, &left, &right);
+    bt_Node *found = _split(tree, other_node, node->data, _node_prefix(tree, node), &other_left, &other_right);
+
+    left = _difference(tree, left, other, other_left);
+    right = _difference(tree, right, other, other_right);
+    if (found != NULL && tree->multiset && found->multiplicity < node->multiplicity) {
+        node->multiplicity -= found->multiplicity;
+        _discard(other, found);
+    } else if (found != NULL) {
+        _discard(other, found);
+        _discard(tree, node);
+        return _join2(tree, left, right);
+    }
+    return _join(tree, left, node, right);
+}
 
+// frees a detached subtree together with its data
+static void _discard(bt_Tree *tree, bt_Node *node) {
     if (node == NULL) {
         return;
     }
 
-    _print(node->left, to_str, level + 1);
+    _discard(tree, node->left);
+    _discard(tree, node->right);
+    _release(tree, node);
+    _free_node(tree, node);
+}
 
-    printf("\n");
-    size_t depth;
-    for (depth = 0; depth < level; depth++) {
-        printf("\t");
+static size_t _overlaps(bt_Tree *tree, bt_Node *node, void *lo, void *hi,
+                        void (*found)(bt_Node *node, void *ctx), void *ctx) {
+    // nothing in this subtree reaches up to lo
+    if (node == NULL || tree->compare_point(*_max_high(tree, node), lo) <= -1) {
+        return 0;
     }
 
-    memset(data_str, 0, DATA_STR_LEN);
-    to_str(node->data, data_str);
-    printf("%s", data_str);
+    size_t overlapping = _overlaps(tree, node->left, lo, hi, found, ctx);
 
-    _print(node->right, to_str, level + 1);
+    // node and its right subtree start behind hi
+    if (tree->compare_point(tree->low(node->data), hi) >= 1) {
+        return overlapping;
+    }
+
+    if (tree->compare_point(lo, tree->high(node->data)) <= 0) {
+        found(node, ctx);
+        overlapping++;
+    }
+    return overlapping + _overlaps(tree, node->right, lo, hi, found, ctx);
 }
 
 static void _delete(bt_Tree *tree) {
-    bt_Node **traversal = NULL;
-    bt_Node *current;
-    size_t idx = 0;
+    bt_Node *current = bt_walk_first(tree, POST_ORDER);
+    bt_Node *next;
+
+    while (current != NULL) {
+        next = bt_walk_next(current, POST_ORDER);
+        _release(tree, current);
+        if (tree->small == NULL) {
+            _free_node(tree, current);
+        }
+        current = next;
+    }
+    _small_free(tree);
+    _compact_reset(tree);
+    _unreserve(tree);
+    free(tree->filter);
+    free(tree);
+    tree = NULL;
+}
 
-    bt_traverse(tree, POST_ORDER, &traversal);
+// finalizer of splitmix64, spreads weak hashes over all bits
+static uint64_t _mix(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
 
-    for (idx = 0; idx < tree->count; idx++) {
-        current = traversal[idx];
-        if (current == NULL) {
-            continue;
+// counters saturate and then stay, so removes never cause false negatives
+static void _filter_update(bt_Tree *tree, void *data, int delta) {
+    if (tree->filter == NULL) {
+        return;
+    }
+
+    uint64_t hash = _mix(tree->hash(data));
+    uint64_t step = (hash >> 32) | 1;
+    int probe;
+    for (probe = 0; probe < 4; probe++) {
+        uint8_t *counter = &tree->filter[(size_t)(hash + probe * step) & (tree->filter_size - 1)];
+        if (*counter != UINT8_MAX) {
+            *counter += delta;
         }
-        if (current->data != NULL) {
-            tree->delete (current->data);
+    }
+}
+
+static bool _filter_check(bt_Tree *tree, void *data) {
+    if (tree->filter == NULL) {
+        return true;
+    }
+
+    uint64_t hash = _mix(tree->hash(data));
+    uint64_t step = (hash >> 32) | 1;
+    int probe;
+    for (probe = 0; probe < 4; probe++) {
+        if (tree->filter[(size_t)(hash + probe * step) & (tree->filter_size - 1)] == 0) {
+            return false;
         }
-        free(current);
-        current = NULL;
     }
-    free(traversal);
-    free(tree);
-    tree = NULL;
+    return true;
+}
+
+static void _filter_rebuild(bt_Tree *tree) {
+    if (tree->filter == NULL) {
+        return;
+    }
+
+    memset(tree->filter, 0, tree->filter_size);
+    bt_Node *node;
+    for (node = bt_first(tree); node != NULL; node = bt_next(node)) {
+        _filter_update(tree, node->data, 1);
+    }
 }
 #endif // _BIN_TREE_IMPL_
 #endif // BINARY_TREE_IMPLEMENTATION
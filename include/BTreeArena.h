@@ -0,0 +1,255 @@
+#ifndef _BTREE_ARENA_
+#define _BTREE_ARENA_
+
+#include "BTree.h"
+
+/**
+ * @brief Size and alignment of the regions an arena carves nodes from, one transparent huge page.
+ */
+#define BT_ARENA_REGION (2 * 1024 * 1024)
+
+/**
+ * @brief Struct that defines an arena carving the nodes of trees from huge page backed regions.
+ *
+ * Random descents through very large trees miss the TLB on almost every node. An arena places the
+ * nodes in regions of BT_ARENA_REGION bytes aligned to it and advised with MADV_HUGEPAGE, so one
+ * TLB entry covers a whole region once the kernel backs it with a huge page. Where huge pages are
+ * not available the regions stay on normal pages, bt_arena_coverage tells how many got huge ones.
+ *
+ * All trees of an arena need nodes of the same size, i.e. the same key and aggregate size. Freed
+ * nodes are reused by later adds, memory is given back when the arena is deleted. An arena must not
+ * be used by several threads at once.
+ *
+ * @example Putting a tree into an arena.
+ *   bt_Arena *arena = bt_arena_create();
+ *   bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+ *   bt_use_arena(tree, arena);
+ *   // adds and removes
+ *   printf("%.0f%% on huge pages\n", 100 * bt_arena_coverage(arena));
+ *   bt_delete(tree);
+ *   bt_arena_delete(arena);
+ */
+struct bt_Arena {
+    /**
+     * Size of the slots nodes are carved into, fixed by the first tree using the arena.
+     */
+    size_t slot_size;
+    /**
+     * Regions mapped so far.
+     */
+    char **regions;
+    size_t region_count;
+    size_t capacity;
+    /**
+     * Next slot of the newest region never handed out.
+     */
+    char *next;
+    /**
+     * Freed slots, each holding a pointer to the next one.
+     */
+    void *free_list;
+    /**
+     * Number of slots handed out and not freed.
+     */
+    size_t used;
+};
+
+struct bt_Arena;
+typedef struct bt_Arena bt_Arena;
+
+/**
+ * @brief Creates an empty arena, regions are mapped on demand.
+ *
+ * @return pointer to the created arena or NULL if memory ran out.
+ */
+bt_Arena *bt_arena_create(void);
+
+/**
+ * @brief Makes tree allocate its nodes from arena.
+ *
+ * @param tree pointer to an empty tree.
+ * @param arena pointer to the arena to use.
+ *
+ * @return true if the tree uses the arena or false if the tree is not empty or its nodes differ in
+ * size from the nodes of the other trees using the arena.
+ */
+bool bt_use_arena(bt_Tree *tree, bt_Arena *arena);
+
+/**
+ * @brief Measures which part of the regions of arena is backed by huge pages.
+ * Reads /proc/self/smaps, so it is slow and meant for monitoring.
+ *
+ * @param arena pointer to an arena.
+ *
+ * @return share of the mapped regions on huge pages between 0 and 1, 0 if it cannot be determined.
+ */
+double bt_arena_coverage(bt_Arena *arena);
+
+/**
+ * @brief deletes the arena and unmaps its regions. Trees using it have to be deleted before.
+ *
+ * @param arena pointer to an arena to delete.
+ */
+void bt_arena_delete(bt_Arena *arena);
+
+#endif // _BTREE_ARENA_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _BTREE_ARENA_IMPL_
+#define _BTREE_ARENA_IMPL_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// alignment of the slots within a region
+#define ARENA_ALIGN 16
+
+// helper methods definition
+static void *_arena_alloc(size_t size, void *ctx);
+static void _arena_free(void *node, void *ctx);
+static bool _arena_map(bt_Arena *arena);
+
+bt_Arena *bt_arena_create(void) {
+    bt_Arena *arena = (bt_Arena *)malloc(sizeof(bt_Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->slot_size = 0;
+    arena->regions = NULL;
+    arena->region_count = 0;
+    arena->capacity = 0;
+    arena->next = NULL;
+    arena->free_list = NULL;
+    arena->used = 0;
+    return arena;
+}
+
+bool bt_use_arena(bt_Tree *tree, bt_Arena *arena) {
+    _settle(tree);
+    size_t size = _node_size(tree);
+    size_t slot_size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (tree->root != NULL || (arena->slot_size != 0 && arena->slot_size != slot_size)) {
+        return false;
+    }
+
+    if (!bt_set_allocator(tree, _arena_alloc, _arena_free, arena)) {
+        return false;
+    }
+    arena->slot_size = slot_size;
+    return true;
+}
+
+double bt_arena_coverage(bt_Arena *arena) {
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL || arena->region_count == 0) {
+        if (smaps != NULL) {
+            fclose(smaps);
+        }
+        return 0;
+    }
+
+    // huge pages are reported per mapping, which may span several regions and other memory
+    char line[256];
+    size_t overlap = 0;
+    size_t huge = 0;
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long start;
+        unsigned long end;
+        unsigned long kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            overlap = 0;
+            size_t idx;
+            for (idx = 0; idx < arena->region_count; idx++) {
+                uintptr_t region = (uintptr_t)arena->regions[idx];
+                if (region >= start && region + BT_ARENA_REGION <= end) {
+                    overlap += BT_ARENA_REGION;
+                }
+            }
+        } else if (overlap > 0 && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            size_t bytes = (size_t)kb * 1024;
+            huge += bytes < overlap ? bytes : overlap;
+        }
+    }
+    fclose(smaps);
+    return (double)huge / (double)(arena->region_count * BT_ARENA_REGION);
+}
+
+void bt_arena_delete(bt_Arena *arena) {
+    size_t idx;
+    for (idx = 0; idx < arena->region_count; idx++) {
+        munmap(arena->regions[idx], BT_ARENA_REGION);
+    }
+    free(arena->regions);
+    free(arena);
+}
+
+// helper methods implementation
+
+static void *_arena_alloc(size_t size, void *ctx) {
+    bt_Arena *arena = (bt_Arena *)ctx;
+    // only nodes fit into a slot
+    if (size > arena->slot_size) {
+        return NULL;
+    }
+    void *slot = arena->free_list;
+    if (slot != NULL) {
+        arena->free_list = *(void **)slot;
+    } else {
+        bool full = arena->region_count == 0 ||
+                    arena->next + arena->slot_size >
+                        arena->regions[arena->region_count - 1] + BT_ARENA_REGION;
+        if (full && !_arena_map(arena)) {
+            return NULL;
+        }
+        slot = arena->next;
+        arena->next += arena->slot_size;
+    }
+    arena->used += 1;
+    return slot;
+}
+
+static void _arena_free(void *node, void *ctx) {
+    bt_Arena *arena = (bt_Arena *)ctx;
+    *(void **)node = arena->free_list;
+    arena->free_list = node;
+    arena->used -= 1;
+}
+
+// maps a region aligned to its size, which the kernel needs to back it with a huge page
+static bool _arena_map(bt_Arena *arena) {
+    char *mapped = (char *)mmap(NULL, 2 * BT_ARENA_REGION, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    // twice the size is mapped, so an aligned region fits in, the rest is unmapped again
+    uintptr_t misalign = (uintptr_t)mapped % BT_ARENA_REGION;
+    size_t head = misalign == 0 ? 0 : BT_ARENA_REGION - (size_t)misalign;
+    char *region = mapped + head;
+    if (head > 0) {
+        munmap(mapped, head);
+    }
+    munmap(region + BT_ARENA_REGION, BT_ARENA_REGION - head);
+#ifdef MADV_HUGEPAGE
+    // without transparent huge pages this fails and the region stays on normal pages
+    madvise(region, BT_ARENA_REGION, MADV_HUGEPAGE);
+#endif
+
+    if (arena->region_count == arena->capacity) {
+        size_t capacity = arena->capacity > 0 ? arena->capacity * 2 : 16;
+        char **regions = (char **)realloc(arena->regions, capacity * sizeof(char *));
+        if (regions == NULL) {
+            munmap(region, BT_ARENA_REGION);
+            return false;
+        }
+        arena->regions = regions;
+        arena->capacity = capacity;
+    }
+    arena->regions[arena->region_count++] = region;
+    arena->next = region;
+    return true;
+}
+#endif // _BTREE_ARENA_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
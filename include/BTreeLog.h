@@ -0,0 +1,654 @@
+#ifndef _BTREE_LOG_
+#define _BTREE_LOG_
+
+#include "BTree.h"
+
+/**
+ * @brief Size of the buffer log records are collected in before they are written.
+ */
+#define BT_LOG_BUFFER 65536
+
+/**
+ * @brief Struct that defines a write-ahead log making a bt_Tree recoverable after a crash.
+ *
+ * Every add and remove done through the log is appended to <path>.log as a checksummed record.
+ * Records are collected in memory and written with a single fsync once group_commit operations
+ * are pending, so a crash loses at most the operations of the last unsynced group. Checkpoints
+ * write the whole tree in order to <path>.ckpt and truncate the log, so recovery only replays the
+ * operations done since the last checkpoint. Files are written in host byte order.
+ *
+ * @example Recovering a tree and logging changes to it.
+ *   bt_Tree *tree = bt_create(compare, BT_TRIVIAL_DELETE);
+ *   bt_recover(tree, "state/tree", deserialize);
+ *   bt_Log *log = bt_log_open(tree, "state/tree", serialize, 64, 1 << 26);
+ *   bt_log_add(log, data);
+ *   bt_log_sync(log);
+ *   bt_log_close(log);
+ *   bt_delete(tree);
+ */
+struct bt_Log {
+    /**
+     * Tree whose changes are logged.
+     */
+    bt_Tree *tree;
+    /**
+     * Path the log and checkpoint file names are derived from.
+     */
+    char *path;
+    /**
+     * File descriptor of the log file.
+     */
+    int fd;
+    /**
+     * Function returning the bytes representing data and writing their number to len.
+     */
+    const void *(*serialize)(void *data, size_t *len);
+    /**
+     * Records not written to the log file yet.
+     */
+    char *buffer;
+    size_t len;
+    /**
+     * Number of operations in buffer.
+     */
+    size_t pending;
+    /**
+     * Number of operations collected before they are written and synced together.
+     */
+    size_t group_commit;
+    /**
+     * Size of the log file at which a checkpoint is written automatically, 0 for never.
+     */
+    size_t checkpoint_bytes;
+    /**
+     * Number of bytes written to the log file since the last checkpoint.
+     */
+    size_t log_bytes;
+    /**
+     * Sequence number of the last logged operation.
+     */
+    uint64_t seq;
+    /**
+     * True once writing to the log failed. Reported by the next bt_log_sync.
+     */
+    bool failed;
+};
+
+struct bt_Log;
+typedef struct bt_Log bt_Log;
+
+/**
+ * @brief Starts logging the changes done to tree.
+ * The current content of tree is written as a checkpoint first, so recover the tree before
+ * opening its log.
+ *
+ * @param tree pointer to a tree to log. Map trees are not supported.
+ * @param path path the names <path>.log and <path>.ckpt are derived from.
+ * @param serialize function returning the bytes representing data and their number in len.
+ * @param group_commit number of operations written and synced together, at least 1.
+ * @param checkpoint_bytes log size at which a checkpoint is written automatically, 0 for never.
+ *
+ * @return pointer to the log or NULL if tree is a map, the files could not be written or memory
+ * ran out.
+ */
+bt_Log *bt_log_open(bt_Tree *tree, const char *path,
+                    const void *(*serialize)(void *data, size_t *len), size_t group_commit,
+                    size_t checkpoint_bytes);
+
+/**
+ * @brief Adds data to the tree of log and logs the addition.
+ *
+ * @param log pointer to a log.
+ * @param data pointer to the data to add.
+ *
+ * @return the result of bt_add.
+ */
+bool bt_log_add(bt_Log *log, void *data);
+
+/**
+ * @brief Removes data from the tree of log and logs the removal.
+ *
+ * @param log pointer to a log.
+ * @param data pointer to the data to remove.
+ *
+ * @return the result of bt_remove.
+ */
+bool bt_log_remove(bt_Log *log, void *data);
+
+/**
+ * @brief Writes all pending operations to the log file and syncs it.
+ *
+ * @param log pointer to a log.
+ *
+ * @return true if everything logged so far is durable or false if writing failed.
+ */
+bool bt_log_sync(bt_Log *log);
+
+/**
+ * @brief Writes the tree of log as a new checkpoint and truncates the log file.
+ *
+ * @param log pointer to a log.
+ *
+ * @return true if the checkpoint was written or false otherwise.
+ */
+bool bt_log_checkpoint(bt_Log *log);
+
+/**
+ * @brief Syncs and closes log. The tree is not deleted.
+ *
+ * @param log pointer to a log.
+ *
+ * @return true if everything logged was durable before closing.
+ */
+bool bt_log_close(bt_Log *log);
+
+/**
+ * @brief Restores a tree from the checkpoint and the log at path.
+ * Replaying costs time in the number of records logged since the last checkpoint.
+ *
+ * @param tree pointer to an empty tree configured like the logged one.
+ * @param path path the log was opened with.
+ * @param deserialize function creating data from the bytes serialize returned for it. Data that
+ * is not kept by the tree is passed to the delete function of tree.
+ *
+ * @return true if the tree was restored, also if there is nothing logged at path, or false if
+ * tree is not empty, the checkpoint is corrupt or memory ran out. The tree may then hold part of
+ * the logged data.
+ */
+bool bt_recover(bt_Tree *tree, const char *path,
+                void *(*deserialize)(const void *bytes, size_t len));
+
+#endif // _BTREE_LOG_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _BTREE_LOG_IMPL_
+#define _BTREE_LOG_IMPL_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { LOG_ADD = 1, LOG_REMOVE = 2 };
+
+static const char _log_magic[8] = {'B', 'T', 'C', 'K', 'P', 'T', '0', '1'};
+
+// sizes of the fixed parts of the on disk records
+enum {
+    LOG_RECORD_HEAD = sizeof(uint64_t) + 1 + sizeof(uint32_t),
+    LOG_CHECKPOINT_HEAD = sizeof(_log_magic) + 2 * sizeof(uint64_t),
+    LOG_ENTRY_HEAD = 2 * sizeof(uint32_t)
+};
+
+// helper methods definition
+static char *_log_file(const char *path, const char *suffix);
+static bool _log_write(int fd, const char *buffer, size_t len);
+static bool _log_flush(bt_Log *log);
+static bool _log_append(bt_Log *log, uint8_t op, void *data);
+static uint32_t _log_checksum(uint32_t hash, const void *bytes, size_t len);
+static char *_log_read(const char *file, size_t *len);
+static uint64_t _log_replay(bt_Tree *tree, const char *file, uint64_t after,
+                            void *(*deserialize)(const void *bytes, size_t len), bool *ok);
+static bool _log_load(bt_Tree *tree, void **data, uint32_t *multiplicity, size_t count);
+static void _log_own(bt_Tree *tree, void *data, bool kept);
+
+bt_Log *bt_log_open(bt_Tree *tree, const char *path,
+                    const void *(*serialize)(void *data, size_t *len), size_t group_commit,
+                    size_t checkpoint_bytes) {
+    if (tree->map) {
+        return NULL;
+    }
+
+    char *log_file = _log_file(path, ".log");
+    char *ckpt_file = _log_file(path, ".ckpt");
+    int fd = log_file != NULL ? open(log_file, O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+    bt_Log *log = fd >= 0 ? (bt_Log *)malloc(sizeof(bt_Log)) : NULL;
+    if (log != NULL) {
+        log->path = strdup(path);
+        log->buffer = (char *)malloc(BT_LOG_BUFFER);
+    }
+    if (ckpt_file == NULL || log == NULL || log->path == NULL || log->buffer == NULL) {
+        if (log != NULL) {
+            free(log->path);
+            free(log->buffer);
+            free(log);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(ckpt_file);
+        free(log_file);
+        return NULL;
+    }
+
+    log->tree = tree;
+    log->fd = fd;
+    log->serialize = serialize;
+    log->len = 0;
+    log->pending = 0;
+    log->group_commit = group_commit > 0 ? group_commit : 1;
+    log->checkpoint_bytes = checkpoint_bytes;
+    log->log_bytes = 0;
+    log->failed = false;
+
+    // continue the sequence of an old log, a checkpoint of the current tree covers all of it
+    size_t len;
+    char *ckpt = _log_read(ckpt_file, &len);
+    log->seq = 0;
+    if (ckpt != NULL && len >= LOG_CHECKPOINT_HEAD) {
+        memcpy(&log->seq, ckpt + sizeof(_log_magic), sizeof(uint64_t));
+    }
+    uint64_t last = _log_replay(tree, log_file, UINT64_MAX, NULL, NULL);
+    log->seq = last > log->seq ? last : log->seq;
+    free(ckpt);
+    free(ckpt_file);
+    free(log_file);
+
+    if (!bt_log_checkpoint(log)) {
+        bt_log_close(log);
+        return NULL;
+    }
+    return log;
+}
+
+bool bt_log_add(bt_Log *log, void *data) {
+    bool added = bt_add(log->tree, data);
+    if (added) {
+        _log_append(log, LOG_ADD, data);
+    }
+    return added;
+}
+
+bool bt_log_remove(bt_Log *log, void *data) {
+    bool removed = bt_remove(log->tree, data);
+    if (removed) {
+        _log_append(log, LOG_REMOVE, data);
+    }
+    return removed;
+}
+
+bool bt_log_sync(bt_Log *log) {
+    if (_log_flush(log) && fsync(log->fd) != 0) {
+        log->failed = true;
+    }
+    log->pending = 0;
+    return !log->failed;
+}
+
+bool bt_log_checkpoint(bt_Log *log) {
+    if (!bt_log_sync(log)) {
+        return false;
+    }
+
+    char *tmp_file = _log_file(log->path, ".ckpt.tmp");
+    char *ckpt_file = _log_file(log->path, ".ckpt");
+    int fd = tmp_file != NULL && ckpt_file != NULL ? open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                                                   : -1;
+    bool ok = fd >= 0;
+
+    // header, then every node in order, then a checksum over the nodes
+    uint64_t count = log->tree->count;
+    memcpy(log->buffer, _log_magic, sizeof(_log_magic));
+    memcpy(log->buffer + sizeof(_log_magic), &log->seq, sizeof(uint64_t));
+    memcpy(log->buffer + sizeof(_log_magic) + sizeof(uint64_t), &count, sizeof(uint64_t));
+    log->len = LOG_CHECKPOINT_HEAD;
+
+    uint32_t checksum = _log_checksum(0, NULL, 0);
+    bt_Node *node;
+    for (node = bt_first(log->tree); ok && node != NULL; node = bt_next(node)) {
+        size_t size;
+        const void *bytes = log->serialize(node->data, &size);
+        uint32_t head[2] = {node->multiplicity, (uint32_t)size};
+
+        if (log->len + LOG_ENTRY_HEAD + size > BT_LOG_BUFFER) {
+            ok = _log_write(fd, log->buffer, log->len);
+            log->len = 0;
+        }
+        if (LOG_ENTRY_HEAD + size > BT_LOG_BUFFER) {
+            checksum = _log_checksum(checksum, head, LOG_ENTRY_HEAD);
+            checksum = _log_checksum(checksum, bytes, size);
+            ok = ok && _log_write(fd, (const char *)head, LOG_ENTRY_HEAD) &&
+                 _log_write(fd, (const char *)bytes, size);
+            continue;
+        }
+
+        memcpy(log->buffer + log->len, head, LOG_ENTRY_HEAD);
+        memcpy(log->buffer + log->len + LOG_ENTRY_HEAD, bytes, size);
+        checksum = _log_checksum(checksum, log->buffer + log->len, LOG_ENTRY_HEAD + size);
+        log->len += LOG_ENTRY_HEAD + size;
+    }
+    ok = ok && _log_write(fd, log->buffer, log->len) &&
+         _log_write(fd, (const char *)&checksum, sizeof(uint32_t));
+    log->len = 0;
+
+    // the rename makes the checkpoint visible atomically
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    ok = ok && rename(tmp_file, ckpt_file) == 0;
+
+    char *dir_name = ok ? strdup(log->path) : NULL;
+    if (dir_name != NULL) {
+        char *slash = strrchr(dir_name, '/');
+        if (slash != NULL) {
+            slash[slash == dir_name ? 1 : 0] = 0;
+        }
+        int dir = open(slash != NULL ? dir_name : ".", O_RDONLY);
+        if (dir >= 0) {
+            fsync(dir);
+            close(dir);
+        }
+    }
+    free(dir_name);
+
+    // records up to seq are skipped when replaying, truncating is only a matter of space
+    if (ok && ftruncate(log->fd, 0) == 0) {
+        fsync(log->fd);
+        log->log_bytes = 0;
+    }
+
+    free(tmp_file);
+    free(ckpt_file);
+    return ok;
+}
+
+bool bt_log_close(bt_Log *log) {
+    bool ok = bt_log_sync(log);
+    close(log->fd);
+    free(log->buffer);
+    free(log->path);
+    free(log);
+    return ok;
+}
+
+bool bt_recover(bt_Tree *tree, const char *path,
+                void *(*deserialize)(const void *bytes, size_t len)) {
+    if (tree->count != 0) {
+        return false;
+    }
+
+    char *ckpt_file = _log_file(path, ".ckpt");
+    char *log_file = _log_file(path, ".log");
+    size_t len;
+    char *ckpt = ckpt_file != NULL ? _log_read(ckpt_file, &len) : NULL;
+    uint64_t seq = 0;
+    bool ok = true;
+
+    if (ckpt != NULL) {
+        uint64_t count = 0;
+        ok = len >= LOG_CHECKPOINT_HEAD + sizeof(uint32_t) &&
+             memcmp(ckpt, _log_magic, sizeof(_log_magic)) == 0;
+        if (ok) {
+            memcpy(&seq, ckpt + sizeof(_log_magic), sizeof(uint64_t));
+            memcpy(&count, ckpt + sizeof(_log_magic) + sizeof(uint64_t), sizeof(uint64_t));
+            uint32_t stored;
+            memcpy(&stored, ckpt + len - sizeof(uint32_t), sizeof(uint32_t));
+            ok = stored == _log_checksum(_log_checksum(0, NULL, 0), ckpt + LOG_CHECKPOINT_HEAD,
+                                         len - LOG_CHECKPOINT_HEAD - sizeof(uint32_t));
+        }
+
+        // every entry takes at least its head, which bounds count before allocating for it
+        ok = ok && count <= (len - LOG_CHECKPOINT_HEAD) / LOG_ENTRY_HEAD;
+        void **data = NULL;
+        uint32_t *multiplicity = NULL;
+        if (ok) {
+            data = (void **)malloc(count * sizeof(void *));
+            multiplicity = (uint32_t *)malloc(count * sizeof(uint32_t));
+            ok = (data != NULL && multiplicity != NULL) || count == 0;
+        }
+
+        size_t end = len - sizeof(uint32_t);
+        size_t pos = LOG_CHECKPOINT_HEAD;
+        size_t idx;
+        for (idx = 0; ok && idx < count; idx++) {
+            uint32_t head[2];
+            if (end - pos < LOG_ENTRY_HEAD) {
+                ok = false;
+                break;
+            }
+            memcpy(head, ckpt + pos, LOG_ENTRY_HEAD);
+            if (end - pos - LOG_ENTRY_HEAD < head[1]) {
+                ok = false;
+                break;
+            }
+            multiplicity[idx] = head[0];
+            data[idx] = deserialize(ckpt + pos + LOG_ENTRY_HEAD, head[1]);
+            pos += LOG_ENTRY_HEAD + head[1];
+        }
+
+        if (ok) {
+            ok = _log_load(tree, data, multiplicity, count);
+        } else {
+            while (idx > 0) {
+                _log_own(tree, data[--idx], false);
+            }
+        }
+        free(data);
+        free(multiplicity);
+        free(ckpt);
+    }
+
+    ok = ok && ckpt_file != NULL && log_file != NULL;
+    if (ok) {
+        _log_replay(tree, log_file, seq, deserialize, &ok);
+    }
+    free(ckpt_file);
+    free(log_file);
+    return ok;
+}
+// helper methods implementation
+
+static char *_log_file(const char *path, const char *suffix) {
+    char *file = (char *)malloc(strlen(path) + strlen(suffix) + 1);
+    if (file == NULL) {
+        return NULL;
+    }
+    strcpy(file, path);
+    strcat(file, suffix);
+    return file;
+}
+
+static bool _log_write(int fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buffer, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+static bool _log_flush(bt_Log *log) {
+    if (log->len > 0) {
+        if (!_log_write(log->fd, log->buffer, log->len)) {
+            log->failed = true;
+        }
+        log->log_bytes += log->len;
+        log->len = 0;
+    }
+    return !log->failed;
+}
+
+static bool _log_append(bt_Log *log, uint8_t op, void *data) {
+    size_t size;
+    const void *bytes = log->serialize(data, &size);
+    uint32_t len = (uint32_t)size;
+    size_t record = LOG_RECORD_HEAD + size + sizeof(uint32_t);
+    log->seq++;
+
+    if (log->len + record > BT_LOG_BUFFER) {
+        _log_flush(log);
+    }
+
+    // records larger than the buffer get their own allocation
+    char *target = record > BT_LOG_BUFFER ? (char *)malloc(record) : log->buffer + log->len;
+    if (target == NULL) {
+        log->failed = true;
+        return false;
+    }
+    memcpy(target, &log->seq, sizeof(uint64_t));
+    target[sizeof(uint64_t)] = (char)op;
+    memcpy(target + sizeof(uint64_t) + 1, &len, sizeof(uint32_t));
+    memcpy(target + LOG_RECORD_HEAD, bytes, size);
+    uint32_t checksum = _log_checksum(_log_checksum(0, NULL, 0), target, LOG_RECORD_HEAD + size);
+    memcpy(target + LOG_RECORD_HEAD + size, &checksum, sizeof(uint32_t));
+
+    if (record > BT_LOG_BUFFER) {
+        if (!_log_write(log->fd, target, record)) {
+            log->failed = true;
+        }
+        log->log_bytes += record;
+        free(target);
+    } else {
+        log->len += record;
+    }
+
+    if (++log->pending >= log->group_commit) {
+        bt_log_sync(log);
+    }
+    if (log->checkpoint_bytes > 0 && log->log_bytes >= log->checkpoint_bytes) {
+        bt_log_checkpoint(log);
+    }
+    return !log->failed;
+}
+
+// FNV-1a, hash 0 with no bytes gives the offset basis
+static uint32_t _log_checksum(uint32_t hash, const void *bytes, size_t len) {
+    const unsigned char *byte = (const unsigned char *)bytes;
+    if (bytes == NULL) {
+        return 2166136261u;
+    }
+    while (len-- > 0) {
+        hash = (hash ^ *byte++) * 16777619u;
+    }
+    return hash;
+}
+
+static char *_log_read(const char *file, size_t *len) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    char *content = NULL;
+    if (fstat(fd, &info) == 0) {
+        content = (char *)malloc(info.st_size > 0 ? (size_t)info.st_size : 1);
+        size_t done = 0;
+        while (content != NULL && done < (size_t)info.st_size) {
+            ssize_t got = read(fd, content + done, (size_t)info.st_size - done);
+            if (got <= 0 && errno != EINTR) {
+                break;
+            }
+            done += got > 0 ? (size_t)got : 0;
+        }
+        *len = done;
+    }
+    close(fd);
+    return content;
+}
+
+// applies the valid records after seq to tree and returns the last sequence number found, a torn
+// or corrupt record ends the log; without deserialize the records are only scanned. ok is cleared
+// if memory ran out while applying them.
+static uint64_t _log_replay(bt_Tree *tree, const char *file, uint64_t after,
+                            void *(*deserialize)(const void *bytes, size_t len), bool *ok) {
+    size_t len;
+    char *content = _log_read(file, &len);
+    if (content == NULL) {
+        return 0;
+    }
+
+    uint64_t last = 0;
+    size_t pos = 0;
+    while (pos + LOG_RECORD_HEAD + sizeof(uint32_t) <= len) {
+        uint64_t seq;
+        uint32_t size;
+        uint32_t stored;
+        memcpy(&seq, content + pos, sizeof(uint64_t));
+        uint8_t op = (uint8_t)content[pos + sizeof(uint64_t)];
+        memcpy(&size, content + pos + sizeof(uint64_t) + 1, sizeof(uint32_t));
+        if (size > len - pos - LOG_RECORD_HEAD - sizeof(uint32_t)) {
+            break;
+        }
+        memcpy(&stored, content + pos + LOG_RECORD_HEAD + size, sizeof(uint32_t));
+        if (stored != _log_checksum(_log_checksum(0, NULL, 0), content + pos,
+                                    LOG_RECORD_HEAD + size)) {
+            break;
+        }
+
+        last = seq;
+        if (deserialize != NULL && seq > after) {
+            void *data = deserialize(content + pos + LOG_RECORD_HEAD, size);
+            size_t count = tree->count;
+            if (op == LOG_ADD) {
+                // a multiset only counts up an existing node, which keeps its own data
+                bt_Status status = bt_try_add(tree, data);
+                _log_own(tree, data, tree->count > count);
+                if (status == BT_ENOMEM) {
+                    *ok = false;
+                    break;
+                }
+            } else {
+                bt_Node *node = bt_find(tree, data);
+                void *stored_data = node != NULL ? node->data : NULL;
+                bt_remove(tree, data);
+                if (tree->count < count) {
+                    _log_own(tree, stored_data, false);
+                }
+                _log_own(tree, data, false);
+            }
+        }
+        pos += LOG_RECORD_HEAD + size + sizeof(uint32_t);
+    }
+
+    free(content);
+    return last;
+}
+
+// adds sorted data median first, which keeps the tree balanced without rotations; if memory runs
+// out the data not added is deleted and false returned
+static bool _log_load(bt_Tree *tree, void **data, uint32_t *multiplicity, size_t count) {
+    if (count == 0) {
+        return true;
+    }
+
+    size_t mid = count / 2;
+    bt_Node *node;
+    if (_add(tree, data[mid], NULL, &node) != BT_OK) {
+        size_t idx;
+        for (idx = 0; idx < count; idx++) {
+            _log_own(tree, data[idx], false);
+        }
+        return false;
+    }
+    tree->count += 1;
+    node->multiplicity = multiplicity[mid];
+    _refresh(tree, node);
+    if (!_log_load(tree, data, multiplicity, mid)) {
+        size_t idx;
+        for (idx = mid + 1; idx < count; idx++) {
+            _log_own(tree, data[idx], false);
+        }
+        return false;
+    }
+    return _log_load(tree, data + mid + 1, multiplicity + mid + 1, count - mid - 1);
+}
+
+// data recovered from disk belongs to the tree, drops it if the tree did not keep it
+static void _log_own(bt_Tree *tree, void *data, bool kept) {
+    if (!kept && data != NULL) {
+        tree->delete (data);
+    }
+}
+#endif // _BTREE_LOG_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
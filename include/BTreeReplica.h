@@ -0,0 +1,237 @@
+#ifndef _BTREE_REPLICA_
+#define _BTREE_REPLICA_
+
+#include "BTree.h"
+
+/**
+ * @brief Struct that defines read-only copies of a bt_Tree, one in the memory of every NUMA node.
+ *
+ * Every replica is a bt_Tree whose struct, nodes, inline keys, aggregates and filter are packed
+ * into one block allocated on its NUMA node, nodes in pre-order. Lookups through the replica of
+ * the local node do not touch remote memory except for data pointers, which are shared by all
+ * replicas. Use inline keys to have the keys replicated as well.
+ *
+ * Placement uses libnuma if BT_HAVE_LIBNUMA is defined and the system supports NUMA. Otherwise a
+ * single replica is built in ordinary memory, which behaves the same on any machine.
+ *
+ * @example Routing lookups of a read-mostly tree to the local replica.
+ *   bt_Replicas *replicas = bt_replicate(tree);
+ *   // on every reading thread, once it runs where it stays
+ *   bt_Tree *local = bt_replica_local(replicas);
+ *   bt_Node *found = bt_find(local, data);
+ *   bt_replicas_delete(replicas);
+ */
+struct bt_Replicas {
+    /**
+     * Replica of every NUMA node, indexed by node number.
+     */
+    bt_Tree **trees;
+    /**
+     * Number of replicas.
+     */
+    size_t count;
+    /**
+     * Size of the block holding every replica in bytes.
+     */
+    size_t block_size;
+};
+
+struct bt_Replicas;
+typedef struct bt_Replicas bt_Replicas;
+
+/**
+ * @brief Copies tree into the memory of every NUMA node.
+ * The copies reflect tree at the time of the call, later changes to tree are not replicated. The
+ * replicas are read-only, do not add to, remove from or delete them.
+ *
+ * @param tree pointer to a tree to replicate. It must not change during the call.
+ *
+ * @return pointer to the created replicas or NULL if memory ran out.
+ */
+bt_Replicas *bt_replicate(bt_Tree *tree);
+
+/**
+ * @brief Returns the replica in the memory of the NUMA node the calling thread runs on.
+ * Finding the node costs a system call, so threads should keep the replica instead of asking for
+ * it on every lookup.
+ *
+ * @param replicas pointer to replicas created by bt_replicate.
+ *
+ * @return pointer to the read-only replica tree.
+ */
+bt_Tree *bt_replica_local(bt_Replicas *replicas);
+
+/**
+ * @brief deletes the replicas. The data is shared with the replicated tree and not deleted.
+ *
+ * @param replicas pointer to replicas to delete.
+ */
+void bt_replicas_delete(bt_Replicas *replicas);
+
+#endif // _BTREE_REPLICA_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _BTREE_REPLICA_IMPL_
+#define _BTREE_REPLICA_IMPL_
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef BT_HAVE_LIBNUMA
+#include <numa.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// alignment of the nodes packed into a replica
+#define REPLICA_ALIGN 16
+// bytes in front of the nodes of a replica holding its bt_Tree
+#define REPLICA_HEAD ((sizeof(bt_Tree) + REPLICA_ALIGN - 1) & ~(size_t)(REPLICA_ALIGN - 1))
+
+// helper methods definition
+static size_t _replica_stride(bt_Tree *tree);
+static void *_replica_alloc(size_t size, size_t node);
+static void _replica_free(void *block, size_t size, size_t node);
+static void _replica_copy(bt_Tree *tree, char *block);
+
+bt_Replicas *bt_replicate(bt_Tree *tree) {
+    bt_Replicas *replicas = (bt_Replicas *)malloc(sizeof(bt_Replicas));
+    if (replicas == NULL) {
+        return NULL;
+    }
+    replicas->count = 1;
+#ifdef BT_HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        replicas->count = (size_t)numa_max_node() + 1;
+    }
+#endif
+    replicas->block_size = REPLICA_HEAD + tree->count * _replica_stride(tree) + tree->filter_size;
+    replicas->trees = (bt_Tree **)malloc(replicas->count * sizeof(bt_Tree *));
+    if (replicas->trees == NULL) {
+        free(replicas);
+        return NULL;
+    }
+
+    size_t node;
+    for (node = 0; node < replicas->count; node++) {
+        char *block = (char *)_replica_alloc(replicas->block_size, node);
+        if (block == NULL) {
+            replicas->count = node;
+            bt_replicas_delete(replicas);
+            return NULL;
+        }
+        _replica_copy(tree, block);
+        replicas->trees[node] = (bt_Tree *)block;
+    }
+    return replicas;
+}
+
+bt_Tree *bt_replica_local(bt_Replicas *replicas) {
+#ifdef BT_HAVE_LIBNUMA
+    unsigned int cpu;
+    unsigned int node;
+    if (replicas->count > 1 && syscall(SYS_getcpu, &cpu, &node, NULL) == 0 &&
+        node < replicas->count) {
+        return replicas->trees[node];
+    }
+#endif
+    return replicas->trees[0];
+}
+
+void bt_replicas_delete(bt_Replicas *replicas) {
+    size_t node;
+    for (node = 0; node < replicas->count; node++) {
+        _replica_free(replicas->trees[node], replicas->block_size, node);
+    }
+    free(replicas->trees);
+    free(replicas);
+}
+
+// helper methods implementation
+
+static size_t _replica_stride(bt_Tree *tree) {
+    size_t size = _node_size(tree);
+    return (size + REPLICA_ALIGN - 1) & ~(size_t)(REPLICA_ALIGN - 1);
+}
+
+static void *_replica_alloc(size_t size, size_t node) {
+#ifdef BT_HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        return numa_alloc_onnode(size, (int)node);
+    }
+#endif
+    (void)node;
+    return malloc(size);
+}
+
+static void _replica_free(void *block, size_t size, size_t node) {
+#ifdef BT_HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        numa_free(block, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)node;
+    free(block);
+}
+
+// packs tree into block, pre-order places the left child right behind its parent and the right
+// child behind the whole left subtree
+static void _replica_copy(bt_Tree *tree, char *block) {
+    size_t stride = _replica_stride(tree);
+    size_t node_size = _node_size(tree);
+    char *nodes = block + REPLICA_HEAD;
+
+    bt_Tree *replica = (bt_Tree *)block;
+    memcpy(replica, tree, sizeof(bt_Tree));
+    replica->root = tree->root != NULL ? (bt_Node *)nodes : NULL;
+    replica->reserve = NULL;
+    replica->reserved = 0;
+    replica->small = NULL;
+    replica->finger_node = NULL;
+    replica->balance_cursor = NULL;
+    if (tree->filter != NULL) {
+        replica->filter = (uint8_t *)(nodes + tree->count * stride);
+        memcpy(replica->filter, tree->filter, tree->filter_size);
+    }
+
+    char *slot = nodes;
+    bt_Node *node;
+    for (node = bt_walk_first(tree, PRE_ORDER); node != NULL;
+         node = bt_walk_next(node, PRE_ORDER)) {
+        bt_Node *copy = (bt_Node *)slot;
+        memcpy(copy, node, node_size);
+        copy->parent = NULL;
+        copy->left = node->left != NULL ? (bt_Node *)(slot + stride) : NULL;
+        copy->right = NULL;
+        if (node->right != NULL) {
+            size_t left_size = node->left != NULL ? node->left->size : 0;
+            copy->right = (bt_Node *)(slot + (left_size + 1) * stride);
+        }
+        if (tree->key_size > 0) {
+            copy->data = _field(tree, copy, BT_LAYOUT_KEY);
+        }
+        slot += stride;
+    }
+
+    // parents are copied before their children, so the links up are set in a second pass
+    for (slot = nodes; slot < nodes + tree->count * stride; slot += stride) {
+        bt_Node *copy = (bt_Node *)slot;
+        if (copy->left != NULL) {
+            copy->left->parent = copy;
+        }
+        if (copy->right != NULL) {
+            copy->right->parent = copy;
+        }
+    }
+
+    // greatest high endpoints may point into the inline keys of tree, children come last
+    if ((tree->layout & BT_LAYOUT_HIGH) && tree->key_size > 0) {
+        for (slot = nodes + tree->count * stride; slot > nodes;) {
+            slot -= stride;
+            _update(replica, (bt_Node *)slot);
+        }
+    }
+}
+#endif // _BTREE_REPLICA_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
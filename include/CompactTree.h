@@ -0,0 +1,529 @@
+#ifndef _COMPACT_TREE_
+#define _COMPACT_TREE_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Index used for missing children. Slot 0 of the node array is never handed out.
+ */
+#define CT_NIL 0
+
+/**
+ * @brief Number of node slots a compact tree can address, slot CT_NIL included.
+ */
+#define CT_MAX_NODES 0x7FFFFFFFu
+
+/**
+ * @brief Struct that defines a node of a compact tree.
+ *
+ * Children are 31 bit indices into the node array of the tree. The highest bit of left marks the
+ * node left heavy and the highest bit of right marks it right heavy, which is all the balance
+ * information an AVL tree needs. With 64 bit pointers a node takes 16 bytes.
+ */
+struct ct_Node {
+    uint32_t left;
+    uint32_t right;
+    /**
+     * Pointer to the data of this node.
+     */
+    void *data;
+};
+
+/**
+ * @brief Struct that defines a compact AVL tree holding all nodes in a single growable array.
+ *
+ * Nodes are addressed by 32 bit indices instead of pointers and are not allocated one by one, so
+ * neither pointers nor malloc headers are paid per node. Removed nodes are kept in a free list
+ * and reused by later adds.
+ *
+ * @example Simple usage of ct_Tree.
+ *   ct_Tree *tree = ct_create(compare, CT_NO_DELETE);
+ *   ct_reserve(tree, 1000);
+ *   ct_add(tree, data);
+ *   void *found = ct_find(tree, data);
+ *   ct_delete(tree);
+ */
+struct ct_Tree {
+    /**
+     * Array holding all nodes of this tree.
+     */
+    struct ct_Node *nodes;
+    /**
+     * Number of slots in nodes.
+     */
+    uint32_t capacity;
+    /**
+     * Number of slots in nodes that have ever been handed out, including slot 0.
+     */
+    uint32_t used;
+    /**
+     * Head of the list of removed nodes, chained through left.
+     */
+    uint32_t free;
+    /**
+     * Index of the root node.
+     */
+    uint32_t root;
+    /**
+     * Counter used for keeping track of the number of nodes in this tree.
+     */
+    size_t count;
+    /**
+     * Comparison function used to order and compare of two data pointers.
+     */
+    int (*compare)(void *d1, void *d2);
+    /**
+     * Deletion function for the data.
+     */
+    void (*delete)(void *data);
+};
+
+struct ct_Node;
+typedef struct ct_Node ct_Node;
+struct ct_Tree;
+typedef struct ct_Tree ct_Tree;
+
+void CT_TRIVIAL_DELETE(void *data);
+void CT_NO_DELETE(void *data);
+
+/**
+ * @brief Creates an empty compact tree with the compare function to determine order.
+ *
+ * @param compare Comparison function used to order and compare of two data pointers.
+ * d1 < d2 return -1 .
+ * d1 = d2 return  0 .
+ * d1 > d2 return  1 .
+ * @param delete Deletion function used to free a node's data pointer when the tree is deleted. In
+ * case you only use pointers that can be trivially freed, provide CT_TRIVIAL_DELETE. In case you do
+ * not want to delete the data, provide CT_NO_DELETE.
+ *
+ * @return pointer to the created tree or NULL if memory ran out.
+ */
+ct_Tree *ct_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data));
+
+/**
+ * @brief Grows the node array so that the tree can hold count nodes without reallocating.
+ *
+ * @param tree pointer to a tree to grow.
+ * @param count number of nodes to make room for.
+ *
+ * @return true if there is room for count nodes or false if count is not below CT_MAX_NODES or
+ * memory ran out, the tree is left as it was then.
+ */
+bool ct_reserve(ct_Tree *tree, size_t count);
+
+/**
+ * @brief Adds data to the tree.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ *
+ * @return true if the data was added or false if the tree already holds equal data, is full or
+ * memory ran out.
+ */
+bool ct_add(ct_Tree *tree, void *data);
+
+/**
+ * @brief Removes the data equal to data from the tree.
+ * The removed data is not deleted.
+ *
+ * @param tree pointer to a tree to remove data from.
+ * @param data pointer to the data to remove.
+ *
+ * @return true if data was removed or false otherwise.
+ */
+bool ct_remove(ct_Tree *tree, void *data);
+
+/**
+ * @brief Searches the data equal to data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to compare against.
+ *
+ * @return pointer to the data held by the tree or NULL if there is none.
+ */
+void *ct_find(ct_Tree *tree, void *data);
+
+/**
+ * @brief Writes all data of the tree in order into the list pointer.
+ *
+ * @param tree pointer to a tree to traverse.
+ * @param list pointer to a list of data pointers.
+ * This list is dynamically allocated and needs to be freed by hand. It is set to NULL if memory
+ * ran out.
+ */
+void ct_traverse(ct_Tree *tree, void ***list);
+
+/**
+ * @brief Calls fn for all data of the tree in order.
+ *
+ * @param tree pointer to a tree to walk.
+ * @param fn function called with every data and ctx. Returning anything but 0 stops the walk.
+ * @param ctx pointer passed through to fn.
+ *
+ * @return 0 if all data was visited or the value fn stopped with.
+ */
+int ct_foreach(ct_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx);
+
+/**
+ * @brief deletes the tree and its data using the delete function set in ct_create.
+ *
+ * @param tree pointer to a tree to delete.
+ */
+void ct_delete(ct_Tree *tree);
+
+#endif // _COMPACT_TREE_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _COMPACT_TREE_IMPL_
+#define _COMPACT_TREE_IMPL_
+
+#include <stdlib.h>
+
+#define CT_INDEX 0x7FFFFFFFu
+#define CT_HEAVY 0x80000000u
+// an AVL tree of CT_MAX_NODES nodes is less than 1.45 * 31 levels high
+#define CT_MAX_HEIGHT 48
+
+// helper methods definition
+static uint32_t _ct_left(ct_Tree *tree, uint32_t node);
+static uint32_t _ct_right(ct_Tree *tree, uint32_t node);
+static void _ct_set_left(ct_Tree *tree, uint32_t node, uint32_t child);
+static void _ct_set_right(ct_Tree *tree, uint32_t node, uint32_t child);
+static int _ct_balance(ct_Tree *tree, uint32_t node);
+static void _ct_set_balance(ct_Tree *tree, uint32_t node, int balance);
+static uint32_t _ct_alloc(ct_Tree *tree);
+static uint32_t _ct_rebalance(ct_Tree *tree, uint32_t node, int balance, bool *lowered);
+static uint32_t _ct_insert(ct_Tree *tree, uint32_t node, uint32_t fresh, int *state);
+static uint32_t _ct_remove(ct_Tree *tree, uint32_t node, void *data, uint32_t *removed,
+                           bool *shrunk);
+static uint32_t _ct_remove_min(ct_Tree *tree, uint32_t node, uint32_t *min, bool *shrunk);
+static uint32_t _ct_after_shrink(ct_Tree *tree, uint32_t node, int balance, bool *shrunk);
+static int _ct_collect(void *data, void *ctx);
+static int _ct_delete_data(void *data, void *ctx);
+
+ct_Tree *ct_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data)) {
+    ct_Tree *tree = (ct_Tree *)malloc(sizeof(ct_Tree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->nodes = NULL;
+    tree->capacity = 0;
+    tree->used = 1;
+    tree->free = CT_NIL;
+    tree->root = CT_NIL;
+    tree->count = 0;
+    tree->compare = compare;
+    tree->delete = delete;
+    return tree;
+}
+
+bool ct_reserve(ct_Tree *tree, size_t count) {
+    if (count >= CT_MAX_NODES) {
+        return false;
+    }
+
+    // slot 0 stays reserved for CT_NIL
+    size_t needed = count + 1;
+    if (needed <= tree->capacity) {
+        return true;
+    }
+
+    ct_Node *nodes = (ct_Node *)realloc(tree->nodes, needed * sizeof(ct_Node));
+    if (nodes == NULL) {
+        return false;
+    }
+    tree->nodes = nodes;
+    tree->capacity = (uint32_t)needed;
+    return true;
+}
+
+bool ct_add(ct_Tree *tree, void *data) {
+    // grow before descending, indices stay valid but the array may move
+    if (tree->free == CT_NIL && tree->used >= tree->capacity) {
+        if (tree->capacity == CT_MAX_NODES) {
+            return false;
+        }
+        size_t grown = tree->capacity < 16 ? 16 : (size_t)tree->capacity * 2;
+        if (!ct_reserve(tree, (grown < CT_MAX_NODES ? grown : CT_MAX_NODES) - 1)) {
+            return false;
+        }
+    }
+
+    uint32_t fresh = _ct_alloc(tree);
+    tree->nodes[fresh].left = CT_NIL;
+    tree->nodes[fresh].right = CT_NIL;
+    tree->nodes[fresh].data = data;
+
+    int state;
+    tree->root = _ct_insert(tree, tree->root, fresh, &state);
+    if (state == 0) {
+        // equal data exists, hand the slot back
+        tree->nodes[fresh].left = tree->free;
+        tree->free = fresh;
+        return false;
+    }
+
+    tree->count += 1;
+    return true;
+}
+
+bool ct_remove(ct_Tree *tree, void *data) {
+    uint32_t removed = CT_NIL;
+    bool shrunk = false;
+    tree->root = _ct_remove(tree, tree->root, data, &removed, &shrunk);
+    if (removed == CT_NIL) {
+        return false;
+    }
+
+    tree->nodes[removed].left = tree->free;
+    tree->free = removed;
+    tree->count -= 1;
+    return true;
+}
+
+void *ct_find(ct_Tree *tree, void *data) {
+    uint32_t node = tree->root;
+    while (node != CT_NIL) {
+        int cmp = tree->compare(data, tree->nodes[node].data);
+        if (cmp == 0) {
+            return tree->nodes[node].data;
+        }
+        node = cmp < 0 ? _ct_left(tree, node) : _ct_right(tree, node);
+    }
+    return NULL;
+}
+
+void ct_traverse(ct_Tree *tree, void ***list) {
+    *list = (void **)malloc(tree->count * sizeof(void *));
+    if (*list == NULL) {
+        return;
+    }
+    void **cursor = *list;
+    ct_foreach(tree, _ct_collect, &cursor);
+}
+
+int ct_foreach(ct_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx) {
+    uint32_t stack[CT_MAX_HEIGHT];
+    int depth = 0;
+    uint32_t node = tree->root;
+
+    while (node != CT_NIL || depth > 0) {
+        while (node != CT_NIL) {
+            stack[depth++] = node;
+            node = _ct_left(tree, node);
+        }
+        node = stack[--depth];
+
+        int stop = fn(tree->nodes[node].data, ctx);
+        if (stop != 0) {
+            return stop;
+        }
+        node = _ct_right(tree, node);
+    }
+    return 0;
+}
+
+void ct_delete(ct_Tree *tree) {
+    // only slots linked into the tree hold data, removed ones are kept in the free list
+    ct_foreach(tree, _ct_delete_data, tree);
+    free(tree->nodes);
+    free(tree);
+}
+
+void CT_TRIVIAL_DELETE(void *data) { free(data); }
+void CT_NO_DELETE(void *data) { (void)data; }
+// helper methods implementation
+
+static uint32_t _ct_left(ct_Tree *tree, uint32_t node) { return tree->nodes[node].left & CT_INDEX; }
+
+static uint32_t _ct_right(ct_Tree *tree, uint32_t node) {
+    return tree->nodes[node].right & CT_INDEX;
+}
+
+static void _ct_set_left(ct_Tree *tree, uint32_t node, uint32_t child) {
+    tree->nodes[node].left = (tree->nodes[node].left & CT_HEAVY) | child;
+}
+
+static void _ct_set_right(ct_Tree *tree, uint32_t node, uint32_t child) {
+    tree->nodes[node].right = (tree->nodes[node].right & CT_HEAVY) | child;
+}
+
+// height of the right minus the height of the left subtree
+static int _ct_balance(ct_Tree *tree, uint32_t node) {
+    return (int)(tree->nodes[node].right >> 31) - (int)(tree->nodes[node].left >> 31);
+}
+
+static void _ct_set_balance(ct_Tree *tree, uint32_t node, int balance) {
+    tree->nodes[node].left = (tree->nodes[node].left & CT_INDEX) | (balance < 0 ? CT_HEAVY : 0);
+    tree->nodes[node].right = (tree->nodes[node].right & CT_INDEX) | (balance > 0 ? CT_HEAVY : 0);
+}
+
+static uint32_t _ct_alloc(ct_Tree *tree) {
+    if (tree->free != CT_NIL) {
+        uint32_t node = tree->free;
+        tree->free = tree->nodes[node].left;
+        return node;
+    }
+    return tree->used++;
+}
+
+// stores balance in node, rotating if it is off by two; lowered tells if a rotation lowered the
+// subtree compared to before the change that unbalanced it
+static uint32_t _ct_rebalance(ct_Tree *tree, uint32_t node, int balance, bool *lowered) {
+    *lowered = false;
+    if (balance >= -1 && balance <= 1) {
+        _ct_set_balance(tree, node, balance);
+        return node;
+    }
+
+    if (balance == -2) {
+        uint32_t left = _ct_left(tree, node);
+        int left_balance = _ct_balance(tree, left);
+        if (left_balance <= 0) {
+            _ct_set_left(tree, node, _ct_right(tree, left));
+            _ct_set_right(tree, left, node);
+            _ct_set_balance(tree, node, left_balance == 0 ? -1 : 0);
+            _ct_set_balance(tree, left, left_balance == 0 ? 1 : 0);
+            *lowered = left_balance != 0;
+            return left;
+        }
+
+        uint32_t pivot = _ct_right(tree, left);
+        int pivot_balance = _ct_balance(tree, pivot);
+        _ct_set_right(tree, left, _ct_left(tree, pivot));
+        _ct_set_left(tree, node, _ct_right(tree, pivot));
+        _ct_set_left(tree, pivot, left);
+        _ct_set_right(tree, pivot, node);
+        _ct_set_balance(tree, node, pivot_balance == -1 ? 1 : 0);
+        _ct_set_balance(tree, left, pivot_balance == 1 ? -1 : 0);
+        _ct_set_balance(tree, pivot, 0);
+        *lowered = true;
+        return pivot;
+    }
+
+    uint32_t right = _ct_right(tree, node);
+    int right_balance = _ct_balance(tree, right);
+    if (right_balance >= 0) {
+        _ct_set_right(tree, node, _ct_left(tree, right));
+        _ct_set_left(tree, right, node);
+        _ct_set_balance(tree, node, right_balance == 0 ? 1 : 0);
+        _ct_set_balance(tree, right, right_balance == 0 ? -1 : 0);
+        *lowered = right_balance != 0;
+        return right;
+    }
+
+    uint32_t pivot = _ct_left(tree, right);
+    int pivot_balance = _ct_balance(tree, pivot);
+    _ct_set_left(tree, right, _ct_right(tree, pivot));
+    _ct_set_right(tree, node, _ct_left(tree, pivot));
+    _ct_set_right(tree, pivot, right);
+    _ct_set_left(tree, pivot, node);
+    _ct_set_balance(tree, node, pivot_balance == 1 ? -1 : 0);
+    _ct_set_balance(tree, right, pivot_balance == -1 ? 1 : 0);
+    _ct_set_balance(tree, pivot, 0);
+    *lowered = true;
+    return pivot;
+}
+
+// state is 0 if equal data exists, 1 if fresh was added and 2 if the subtree grew by adding it
+static uint32_t _ct_insert(ct_Tree *tree, uint32_t node, uint32_t fresh, int *state) {
+    if (node == CT_NIL) {
+        *state = 2;
+        return fresh;
+    }
+
+    int cmp = tree->compare(tree->nodes[fresh].data, tree->nodes[node].data);
+    if (cmp == 0) {
+        *state = 0;
+        return node;
+    }
+
+    int balance;
+    if (cmp < 0) {
+        _ct_set_left(tree, node, _ct_insert(tree, _ct_left(tree, node), fresh, state));
+        balance = _ct_balance(tree, node) - 1;
+    } else {
+        _ct_set_right(tree, node, _ct_insert(tree, _ct_right(tree, node), fresh, state));
+        balance = _ct_balance(tree, node) + 1;
+    }
+
+    if (*state != 2) {
+        return node;
+    }
+
+    bool lowered;
+    uint32_t root = _ct_rebalance(tree, node, balance, &lowered);
+    if (root != node || balance == 0) {
+        *state = 1;
+    }
+    return root;
+}
+
+// shrunk tells if the subtree got lower by removing data
+static uint32_t _ct_remove(ct_Tree *tree, uint32_t node, void *data, uint32_t *removed,
+                           bool *shrunk) {
+    if (node == CT_NIL) {
+        return CT_NIL;
+    }
+
+    int cmp = tree->compare(data, tree->nodes[node].data);
+    if (cmp < 0) {
+        _ct_set_left(tree, node, _ct_remove(tree, _ct_left(tree, node), data, removed, shrunk));
+        return *shrunk ? _ct_after_shrink(tree, node, _ct_balance(tree, node) + 1, shrunk) : node;
+    }
+    if (cmp > 0) {
+        _ct_set_right(tree, node, _ct_remove(tree, _ct_right(tree, node), data, removed, shrunk));
+        return *shrunk ? _ct_after_shrink(tree, node, _ct_balance(tree, node) - 1, shrunk) : node;
+    }
+
+    *removed = node;
+    if (_ct_left(tree, node) == CT_NIL || _ct_right(tree, node) == CT_NIL) {
+        *shrunk = true;
+        return _ct_left(tree, node) | _ct_right(tree, node);
+    }
+
+    // the successor takes the place and balance of node
+    uint32_t successor;
+    uint32_t right = _ct_remove_min(tree, _ct_right(tree, node), &successor, shrunk);
+    tree->nodes[successor].left = tree->nodes[node].left;
+    tree->nodes[successor].right = (tree->nodes[node].right & CT_HEAVY) | right;
+    if (*shrunk) {
+        return _ct_after_shrink(tree, successor, _ct_balance(tree, successor) - 1, shrunk);
+    }
+    return successor;
+}
+
+static uint32_t _ct_remove_min(ct_Tree *tree, uint32_t node, uint32_t *min, bool *shrunk) {
+    if (_ct_left(tree, node) == CT_NIL) {
+        *min = node;
+        *shrunk = true;
+        return _ct_right(tree, node);
+    }
+
+    _ct_set_left(tree, node, _ct_remove_min(tree, _ct_left(tree, node), min, shrunk));
+    return *shrunk ? _ct_after_shrink(tree, node, _ct_balance(tree, node) + 1, shrunk) : node;
+}
+
+static uint32_t _ct_after_shrink(ct_Tree *tree, uint32_t node, int balance, bool *shrunk) {
+    bool lowered;
+    uint32_t root = _ct_rebalance(tree, node, balance, &lowered);
+    *shrunk = root == node ? balance == 0 : lowered;
+    return root;
+}
+
+static int _ct_collect(void *data, void *ctx) {
+    void ***cursor = (void ***)ctx;
+    *(*cursor)++ = data;
+    return 0;
+}
+
+static int _ct_delete_data(void *data, void *ctx) {
+    ct_Tree *tree = (ct_Tree *)ctx;
+    tree->delete (data);
+    return 0;
+}
+#endif // _COMPACT_TREE_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
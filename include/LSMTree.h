@@ -0,0 +1,534 @@
+#ifndef _LSM_TREE_
+#define _LSM_TREE_
+
+#include "BTree.h"
+
+/**
+ * @brief Number of sorted runs above which freezing the memtable forces merges.
+ */
+#define LSM_MAX_RUNS 16
+
+/**
+ * @brief Bloom filter bits spent per entry of a sorted run.
+ */
+#define LSM_BLOOM_BITS 10
+
+/**
+ * @brief Struct that defines an entry of a sorted run.
+ */
+struct lsm_Entry {
+    void *data;
+    /**
+     * True if this entry records a removal shadowing older versions of data.
+     */
+    bool tombstone;
+};
+
+/**
+ * @brief Struct that defines an immutable sorted run, the frozen content of a memtable.
+ */
+struct lsm_Run {
+    /**
+     * Entries ordered by data.
+     */
+    struct lsm_Entry *entries;
+    size_t count;
+    /**
+     * Bloom filter over the entries or NULL if the tree has no hash function.
+     */
+    uint64_t *bloom;
+    /**
+     * Number of bits in bloom, a power of two.
+     */
+    size_t bloom_bits;
+};
+
+/**
+ * @brief Struct that defines a log-structured merge tree for write heavy workloads.
+ *
+ * Adds and removes only touch a small memtable bt_Tree. Once it holds memtable_limit entries it
+ * is frozen into an immutable sorted run, written sequentially. Lookups check the memtable and
+ * then the runs from newest to oldest, skipping runs whose bloom filter rules the data out.
+ * lsm_merge_step merges runs to keep their number low, call it when there is time to spare.
+ *
+ * Merging is synchronous: lsm_merge_step runs on the calling thread and lsm_freeze merges inline
+ * once there are more than LSM_MAX_RUNS runs. The tree does no locking, calls on the same tree
+ * have to be serialized by the caller.
+ *
+ * The tree owns every pointer handed to lsm_add and lsm_remove. A pointer is passed to delete once
+ * it is shadowed by a newer version and merged away or when the tree is deleted. Do not hand the
+ * same pointer in for two different versions.
+ *
+ * @example Simple usage of lsm_Tree.
+ *   lsm_Tree *tree = lsm_create(compare, hash, BT_TRIVIAL_DELETE, 4096);
+ *   lsm_add(tree, data);
+ *   lsm_remove(tree, probe);
+ *   void *found = lsm_find(tree, data);
+ *   while (lsm_merge_step(tree)) {
+ *   }
+ *   lsm_delete(tree);
+ */
+struct lsm_Tree {
+    /**
+     * Mutable tree taking all writes, balanced by SCAPEGOAT_BALANCE. Tombstones are marked
+     * through the value of their node.
+     */
+    bt_Tree *memtable;
+    /**
+     * Number of memtable entries at which it is frozen into a run.
+     */
+    size_t memtable_limit;
+    /**
+     * Sorted runs ordered from newest to oldest.
+     */
+    struct lsm_Run *runs;
+    size_t run_count;
+    /**
+     * Comparison function used to order and compare of two data pointers.
+     */
+    int (*compare)(void *d1, void *d2);
+    /**
+     * Hash function for data used by the bloom filters or NULL to go without them.
+     */
+    uint64_t (*hash)(void *data);
+    /**
+     * Deletion function for the data.
+     */
+    void (*delete)(void *data);
+};
+
+struct lsm_Entry;
+typedef struct lsm_Entry lsm_Entry;
+struct lsm_Run;
+typedef struct lsm_Run lsm_Run;
+struct lsm_Tree;
+typedef struct lsm_Tree lsm_Tree;
+
+/**
+ * @brief Creates an empty log-structured merge tree.
+ *
+ * @param compare Comparison function used to order and compare of two data pointers.
+ * @param hash Hash function for data used by the per run bloom filters. Equal data has to hash
+ * equally. Provide NULL to go without bloom filters.
+ * @param delete Deletion function used to free data once it is merged away or the tree is deleted.
+ * @param memtable_limit number of entries at which the memtable is frozen into a sorted run.
+ *
+ * @return pointer to the created tree or NULL if memory ran out.
+ */
+lsm_Tree *lsm_create(int (*compare)(void *d1, void *d2), uint64_t (*hash)(void *data),
+                     void (*delete)(void *data), size_t memtable_limit);
+
+/**
+ * @brief Adds data to the tree, replacing an equal data added before.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add.
+ *
+ * @return true if the data was added or false if memory ran out, the tree does not own data then.
+ */
+bool lsm_add(lsm_Tree *tree, void *data);
+
+/**
+ * @brief Removes the data equal to data by recording a tombstone.
+ * data itself becomes the key of the tombstone and is owned by the tree from now on.
+ *
+ * @param tree pointer to a tree to remove data from.
+ * @param data pointer to the data to remove.
+ *
+ * @return true if the tombstone was recorded or false if memory ran out, the tree does not own
+ * data then.
+ */
+bool lsm_remove(lsm_Tree *tree, void *data);
+
+/**
+ * @brief Searches the newest version of the data equal to data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to compare against.
+ *
+ * @return pointer to the data held by the tree or NULL if there is none or it was removed.
+ */
+void *lsm_find(lsm_Tree *tree, void *data);
+
+/**
+ * @brief Freezes the memtable into a new sorted run.
+ *
+ * @param tree pointer to a tree.
+ *
+ * @return true if the memtable was frozen or is empty or false if memory ran out, the memtable is
+ * kept then.
+ */
+bool lsm_freeze(lsm_Tree *tree);
+
+/**
+ * @brief Merges the newest pair of adjacent runs whose sizes are within a factor of two.
+ * Merging into the oldest run drops tombstones together with the data they shadow.
+ *
+ * @param tree pointer to a tree.
+ *
+ * @return true if runs were merged or false if there was nothing to merge or memory ran out.
+ */
+bool lsm_merge_step(lsm_Tree *tree);
+
+/**
+ * @brief Calls fn for the newest version of all data of the tree in order, skipping removed data.
+ *
+ * @param tree pointer to a tree to walk.
+ * @param fn function called with every data and ctx. Returning anything but 0 stops the walk.
+ * @param ctx pointer passed through to fn.
+ *
+ * @return 0 if all data was visited, the value fn stopped with or -1 if memory ran out before
+ * anything was visited.
+ */
+int lsm_foreach(lsm_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx);
+
+/**
+ * @brief deletes the tree and its data using the delete function set in lsm_create.
+ *
+ * @param tree pointer to a tree to delete.
+ */
+void lsm_delete(lsm_Tree *tree);
+
+#endif // _LSM_TREE_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _LSM_TREE_IMPL_
+#define _LSM_TREE_IMPL_
+
+#include <stdlib.h>
+#include <string.h>
+
+// value of memtable nodes holding a tombstone
+static char _lsm_tombstone;
+
+// helper methods definition
+static bt_Tree *_lsm_memtable(lsm_Tree *tree);
+static bool _lsm_put(lsm_Tree *tree, void *data, bool tombstone);
+static void _lsm_drop(lsm_Tree *tree, void *data, void *newer);
+static void _lsm_bloom_build(lsm_Tree *tree, lsm_Run *run);
+static bool _lsm_bloom_check(lsm_Run *run, uint64_t hash);
+static lsm_Entry *_lsm_search(lsm_Tree *tree, lsm_Run *run, void *data);
+static bool _lsm_merge(lsm_Tree *tree, size_t newer);
+
+lsm_Tree *lsm_create(int (*compare)(void *d1, void *d2), uint64_t (*hash)(void *data),
+                     void (*delete)(void *data), size_t memtable_limit) {
+    lsm_Tree *tree = (lsm_Tree *)malloc(sizeof(lsm_Tree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->memtable_limit = memtable_limit > 0 ? memtable_limit : 1;
+    tree->runs = NULL;
+    tree->run_count = 0;
+    tree->compare = compare;
+    tree->hash = hash;
+    tree->delete = delete;
+    tree->memtable = _lsm_memtable(tree);
+    if (tree->memtable == NULL) {
+        free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+bool lsm_add(lsm_Tree *tree, void *data) { return _lsm_put(tree, data, false); }
+
+bool lsm_remove(lsm_Tree *tree, void *data) { return _lsm_put(tree, data, true); }
+
+void *lsm_find(lsm_Tree *tree, void *data) {
+    bt_Node *node = bt_find(tree->memtable, data);
+    if (node != NULL) {
+        return *bt_node_value(node) == &_lsm_tombstone ? NULL : node->data;
+    }
+
+    uint64_t hash = tree->hash != NULL ? _mix(tree->hash(data)) : 0;
+    size_t idx;
+    for (idx = 0; idx < tree->run_count; idx++) {
+        lsm_Run *run = &tree->runs[idx];
+        if (run->bloom != NULL && !_lsm_bloom_check(run, hash)) {
+            continue;
+        }
+
+        lsm_Entry *entry = _lsm_search(tree, run, data);
+        if (entry != NULL) {
+            return entry->tombstone ? NULL : entry->data;
+        }
+    }
+    return NULL;
+}
+
+bool lsm_freeze(lsm_Tree *tree) {
+    if (tree->memtable->count == 0) {
+        return true;
+    }
+
+    lsm_Run run;
+    run.count = tree->memtable->count;
+    run.entries = (lsm_Entry *)malloc(run.count * sizeof(lsm_Entry));
+    bt_Tree *memtable = _lsm_memtable(tree);
+    lsm_Run *runs = (lsm_Run *)realloc(tree->runs, (tree->run_count + 1) * sizeof(lsm_Run));
+    if (runs != NULL) {
+        tree->runs = runs;
+    }
+    if (run.entries == NULL || memtable == NULL || runs == NULL) {
+        free(run.entries);
+        if (memtable != NULL) {
+            bt_delete(memtable);
+        }
+        return false;
+    }
+
+    size_t idx = 0;
+    bt_Node *node;
+    for (node = bt_first(tree->memtable); node != NULL; node = bt_next(node)) {
+        run.entries[idx].data = node->data;
+        run.entries[idx].tombstone = *bt_node_value(node) == &_lsm_tombstone;
+        idx++;
+    }
+    _lsm_bloom_build(tree, &run);
+
+    bt_delete(tree->memtable);
+    tree->memtable = memtable;
+
+    memmove(tree->runs + 1, tree->runs, tree->run_count * sizeof(lsm_Run));
+    tree->runs[0] = run;
+    tree->run_count++;
+
+    // bound the number of runs a lookup has to check
+    while (tree->run_count > LSM_MAX_RUNS) {
+        if (!lsm_merge_step(tree) && !_lsm_merge(tree, 0)) {
+            // out of memory, the next freeze tries again
+            break;
+        }
+    }
+    return true;
+}
+
+bool lsm_merge_step(lsm_Tree *tree) {
+    size_t idx;
+    for (idx = 0; idx + 1 < tree->run_count; idx++) {
+        if (tree->runs[idx].count * 2 >= tree->runs[idx + 1].count) {
+            return _lsm_merge(tree, idx);
+        }
+    }
+    return false;
+}
+
+int lsm_foreach(lsm_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx) {
+    // merge the memtable and all runs, the newest source wins on equal data
+    size_t *cursors = (size_t *)calloc(tree->run_count, sizeof(size_t));
+    if (cursors == NULL && tree->run_count > 0) {
+        return -1;
+    }
+    bt_Node *node = bt_first(tree->memtable);
+    int stop = 0;
+
+    while (stop == 0) {
+        void *min = node != NULL ? node->data : NULL;
+        bool tombstone = node != NULL && *bt_node_value(node) == &_lsm_tombstone;
+        size_t idx;
+        for (idx = 0; idx < tree->run_count; idx++) {
+            lsm_Run *run = &tree->runs[idx];
+            if (cursors[idx] < run->count &&
+                (min == NULL || tree->compare(run->entries[cursors[idx]].data, min) < 0)) {
+                min = run->entries[cursors[idx]].data;
+                tombstone = run->entries[cursors[idx]].tombstone;
+            }
+        }
+        if (min == NULL) {
+            break;
+        }
+
+        if (node != NULL && tree->compare(node->data, min) == 0) {
+            node = bt_next(node);
+        }
+        for (idx = 0; idx < tree->run_count; idx++) {
+            lsm_Run *run = &tree->runs[idx];
+            if (cursors[idx] < run->count &&
+                tree->compare(run->entries[cursors[idx]].data, min) == 0) {
+                cursors[idx]++;
+            }
+        }
+
+        if (!tombstone) {
+            stop = fn(min, ctx);
+        }
+    }
+
+    free(cursors);
+    return stop;
+}
+
+void lsm_delete(lsm_Tree *tree) {
+    // merging everything drops shadowed data exactly once
+    bt_Node *node;
+    if (lsm_freeze(tree)) {
+        while (tree->run_count > 1 && _lsm_merge(tree, tree->run_count - 2)) {
+        }
+    } else {
+        for (node = bt_first(tree->memtable); node != NULL; node = bt_next(node)) {
+            tree->delete (node->data);
+        }
+    }
+
+    size_t run;
+    size_t idx;
+    for (run = 0; run < tree->run_count; run++) {
+        for (idx = 0; idx < tree->runs[run].count; idx++) {
+            tree->delete (tree->runs[run].entries[idx].data);
+        }
+        free(tree->runs[run].entries);
+        free(tree->runs[run].bloom);
+    }
+    free(tree->runs);
+    bt_delete(tree->memtable);
+    free(tree);
+}
+// helper methods implementation
+
+// creates an empty memtable, adds rebuild scapegoats instead of rotating on every add
+static bt_Tree *_lsm_memtable(lsm_Tree *tree) {
+    // the value of a node marks tombstones
+    bt_Tree *memtable = bt_create_map(tree->compare, 0, BT_NO_DELETE);
+    if (memtable != NULL) {
+        memtable->balance = SCAPEGOAT_BALANCE;
+    }
+    return memtable;
+}
+
+static bool _lsm_put(lsm_Tree *tree, void *data, bool tombstone) {
+    bt_Node *node;
+    bt_Status status = bt_upsert(tree->memtable, data, &node);
+    if (status == BT_ENOMEM) {
+        return false;
+    }
+    if (status == BT_EXISTS) {
+        // a newer version replaces the one in the memtable
+        _lsm_drop(tree, node->data, data);
+        node->data = data;
+    }
+    *bt_node_value(node) = tombstone ? &_lsm_tombstone : NULL;
+
+    // a failed freeze keeps the data in the memtable and is retried by the next add
+    if (tree->memtable->count >= tree->memtable_limit) {
+        lsm_freeze(tree);
+    }
+    return true;
+}
+
+// deletes data shadowed by newer unless both are the same pointer
+static void _lsm_drop(lsm_Tree *tree, void *data, void *newer) {
+    if (data != newer) {
+        tree->delete (data);
+    }
+}
+
+static void _lsm_bloom_build(lsm_Tree *tree, lsm_Run *run) {
+    run->bloom = NULL;
+    run->bloom_bits = 0;
+    if (tree->hash == NULL) {
+        return;
+    }
+
+    size_t bits = 64;
+    while (bits < run->count * LSM_BLOOM_BITS) {
+        bits <<= 1;
+    }
+    // without memory for the filter lookups search the run
+    run->bloom = (uint64_t *)calloc(bits / 64, sizeof(uint64_t));
+    if (run->bloom == NULL) {
+        return;
+    }
+    run->bloom_bits = bits;
+
+    size_t idx;
+    int probe;
+    for (idx = 0; idx < run->count; idx++) {
+        uint64_t hash = _mix(tree->hash(run->entries[idx].data));
+        uint64_t step = (hash >> 32) | 1;
+        for (probe = 0; probe < 4; probe++) {
+            size_t bit = (size_t)(hash + probe * step) & (bits - 1);
+            run->bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+    }
+}
+
+static bool _lsm_bloom_check(lsm_Run *run, uint64_t hash) {
+    uint64_t step = (hash >> 32) | 1;
+    int probe;
+    for (probe = 0; probe < 4; probe++) {
+        size_t bit = (size_t)(hash + probe * step) & (run->bloom_bits - 1);
+        if ((run->bloom[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static lsm_Entry *_lsm_search(lsm_Tree *tree, lsm_Run *run, void *data) {
+    size_t lo = 0;
+    size_t hi = run->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = tree->compare(data, run->entries[mid].data);
+        if (cmp == 0) {
+            return &run->entries[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+// merges the runs at newer and newer + 1 into one, false if memory ran out
+static bool _lsm_merge(lsm_Tree *tree, size_t newer) {
+    lsm_Run *young = &tree->runs[newer];
+    lsm_Run *old = &tree->runs[newer + 1];
+    bool bottom = newer + 2 == tree->run_count;
+
+    lsm_Run run;
+    run.entries = (lsm_Entry *)malloc((young->count + old->count) * sizeof(lsm_Entry));
+    if (run.entries == NULL) {
+        return false;
+    }
+    run.count = 0;
+
+    size_t y = 0;
+    size_t o = 0;
+    while (y < young->count || o < old->count) {
+        lsm_Entry entry;
+        int cmp = y == young->count ? 1
+                  : o == old->count ? -1
+                                    : tree->compare(young->entries[y].data, old->entries[o].data);
+        if (cmp < 0) {
+            entry = young->entries[y++];
+        } else if (cmp > 0) {
+            entry = old->entries[o++];
+        } else {
+            entry = young->entries[y++];
+            _lsm_drop(tree, old->entries[o++].data, entry.data);
+        }
+
+        // nothing older is left to shadow
+        if (bottom && entry.tombstone) {
+            tree->delete (entry.data);
+            continue;
+        }
+        run.entries[run.count++] = entry;
+    }
+    _lsm_bloom_build(tree, &run);
+
+    free(young->entries);
+    free(young->bloom);
+    free(old->entries);
+    free(old->bloom);
+    tree->runs[newer] = run;
+    memmove(tree->runs + newer + 1, tree->runs + newer + 2,
+            (tree->run_count - newer - 2) * sizeof(lsm_Run));
+    tree->run_count--;
+    return true;
+}
+#endif // _LSM_TREE_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
@@ -0,0 +1,475 @@
+#ifndef _SHARDED_TREE_
+#define _SHARDED_TREE_
+
+#include "BTree.h"
+#include <pthread.h>
+
+/**
+ * @brief Struct that defines a shard, a bt_Tree holding one key range behind its own lock.
+ */
+struct sh_Shard {
+    bt_Tree *tree;
+    pthread_rwlock_t lock;
+    /**
+     * Smallest data routed to this shard, NULL for the first shard.
+     */
+    void *low;
+    /**
+     * Smallest data routed to the next shard, NULL for the last shard. Splits lower it while they
+     * hold the lock of the shard.
+     */
+    void *high;
+    /**
+     * True if low was removed from the shard and is only kept alive for routing.
+     */
+    bool pinned;
+};
+
+/**
+ * @brief Struct that defines a routing table, the shards ordered by their key range.
+ * Tables outgrown by splits are kept until the tree is deleted, as threads routing concurrently may
+ * still read them. Their capacities double, so they take less memory than the table in use.
+ */
+struct sh_Routing {
+    size_t capacity;
+    struct sh_Routing *retired;
+    struct sh_Shard **shards;
+    /**
+     * Split keys, bounds[idx] is the smallest data routed to shards[idx + 1].
+     */
+    void **bounds;
+};
+
+/**
+ * @brief Struct that defines a range partitioned tree for concurrent access from many threads.
+ *
+ * The data is spread over shards holding consecutive key ranges, each one an independent bt_Tree
+ * with its own read-write lock. A routing table of split keys maps data to its shard, so threads
+ * working on different key ranges never wait for each other. A shard growing beyond split_size
+ * nodes is split at its median with bt_split.
+ *
+ * The routing table is guarded by a sequence lock. Threads routing data only read it and retry if
+ * a split changed it meanwhile, so they do not write to a cache line shared by all threads.
+ *
+ * The tree owns the data added to it. Removes pass the removed data to delete, unless it is a split
+ * key still needed for routing, which is then deleted together with the tree. Data returned by
+ * sh_find stays valid until it is removed.
+ *
+ * @example Simple usage of sh_Tree.
+ *   sh_Tree *tree = sh_create(compare, BT_TRIVIAL_DELETE, 1 << 16);
+ *   sh_add(tree, data);
+ *   void *found = sh_find(tree, probe);
+ *   sh_remove(tree, probe);
+ *   sh_delete(tree);
+ */
+struct sh_Tree {
+    /**
+     * Routing table and number of shards in it.
+     */
+    struct sh_Routing *routing;
+    size_t shard_count;
+    /**
+     * Sequence of the routing table, odd while a split changes it.
+     */
+    size_t sequence;
+    /**
+     * Serializes the splits.
+     */
+    pthread_mutex_t splitting;
+    /**
+     * Number of nodes above which a shard is split.
+     */
+    size_t split_size;
+    /**
+     * Comparison function used to order and compare of two data pointers.
+     */
+    int (*compare)(void *d1, void *d2);
+    /**
+     * Deletion function for the data.
+     */
+    void (*delete)(void *data);
+};
+
+struct sh_Shard;
+typedef struct sh_Shard sh_Shard;
+struct sh_Routing;
+typedef struct sh_Routing sh_Routing;
+struct sh_Tree;
+typedef struct sh_Tree sh_Tree;
+
+/**
+ * @brief Creates an empty sharded tree with a single shard.
+ * The shard trees are created by bt_create and split with bt_split, which keeps their modes. So
+ * modes like the balance strategy can be set on shards[0]->tree before the first add.
+ *
+ * @param compare Comparison function used to order and compare of two data pointers.
+ * @param delete Deletion function used to free removed data and all data when the tree is deleted.
+ * @param split_size number of nodes above which a shard is split in two.
+ *
+ * @return pointer to the created tree or NULL if memory ran out.
+ */
+sh_Tree *sh_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data),
+                   size_t split_size);
+
+/**
+ * @brief Adds data to the shard of its key range, splitting the shard if it got too large.
+ * If memory for a split runs out the shard stays as it is and the next add retries.
+ *
+ * @param tree pointer to a tree to add this data to.
+ * @param data pointer to the data to add, owned by the tree if it was added.
+ *
+ * @return true if the data was added or false if equal data is held already.
+ */
+bool sh_add(sh_Tree *tree, void *data);
+
+/**
+ * @brief Removes the data equal to data and deletes it.
+ *
+ * @param tree pointer to a tree to remove data from.
+ * @param data pointer to data equal to the data to remove, it stays owned by the caller.
+ *
+ * @return true if the data was removed or false otherwise.
+ */
+bool sh_remove(sh_Tree *tree, void *data);
+
+/**
+ * @brief Searches the data equal to data.
+ *
+ * @param tree pointer to a tree to search in.
+ * @param data pointer to the data to search for.
+ *
+ * @return the data held by the tree or NULL if there is none.
+ */
+void *sh_find(sh_Tree *tree, void *data);
+
+/**
+ * @brief Calls fn for all data of the tree in order.
+ * As the shards hold consecutive key ranges, merging them comes down to walking them one after the
+ * other. Every shard is locked shared while it is walked, so changes to shards walked already or
+ * not walked yet may be seen partially.
+ *
+ * @param tree pointer to a tree to walk.
+ * @param fn function called with every data and ctx. It must not call sh_add or sh_remove, which
+ * would wait forever for the lock held on the shard being walked. Returning anything but 0 stops
+ * the walk.
+ * @param ctx pointer passed through to fn.
+ *
+ * @return 0 if all data was visited or the value fn stopped with.
+ */
+int sh_foreach(sh_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx);
+
+/**
+ * @brief Counts the data of all shards.
+ *
+ * @param tree pointer to a tree to count.
+ *
+ * @return number of data held by the tree.
+ */
+size_t sh_count(sh_Tree *tree);
+
+/**
+ * @brief deletes the tree and its data using the delete function set in sh_create.
+ * No other thread may use the tree anymore.
+ *
+ * @param tree pointer to a tree to delete.
+ */
+void sh_delete(sh_Tree *tree);
+
+#endif // _SHARDED_TREE_
+
+#ifdef BINARY_TREE_IMPLEMENTATION
+#ifndef _SHARDED_TREE_IMPL_
+#define _SHARDED_TREE_IMPL_
+
+#include <stdlib.h>
+
+// helper methods definition
+static sh_Shard *_sh_shard(bt_Tree *shard_tree, void *low, void *high);
+static sh_Routing *_sh_routing(size_t capacity);
+static sh_Shard *_sh_lock(sh_Tree *tree, void *data, bool write);
+static size_t _sh_route(sh_Tree *tree, sh_Routing *routing, size_t count, void *data);
+static void _sh_split(sh_Tree *tree, sh_Shard *shard);
+static void *_sh_median(bt_Tree *shard_tree);
+
+sh_Tree *sh_create(int (*compare)(void *d1, void *d2), void (*delete)(void *data),
+                   size_t split_size) {
+    sh_Tree *tree = (sh_Tree *)malloc(sizeof(sh_Tree));
+    if (tree == NULL) {
+        return NULL;
+    }
+    tree->routing = _sh_routing(4);
+    bt_Tree *shard_tree = bt_create(compare, delete);
+    sh_Shard *shard = shard_tree != NULL ? _sh_shard(shard_tree, NULL, NULL) : NULL;
+    if (tree->routing == NULL || shard == NULL) {
+        if (shard != NULL) {
+            pthread_rwlock_destroy(&shard->lock);
+            free(shard);
+        }
+        if (shard_tree != NULL) {
+            bt_delete(shard_tree);
+        }
+        free(tree->routing);
+        free(tree);
+        return NULL;
+    }
+    tree->routing->shards[0] = shard;
+    tree->shard_count = 1;
+    tree->sequence = 0;
+    pthread_mutex_init(&tree->splitting, NULL);
+    tree->split_size = split_size > 1 ? split_size : 2;
+    tree->compare = compare;
+    tree->delete = delete;
+    return tree;
+}
+
+bool sh_add(sh_Tree *tree, void *data) {
+    sh_Shard *shard = _sh_lock(tree, data, true);
+    bool added = bt_add(shard->tree, data);
+    bool split = added && shard->tree->count > tree->split_size;
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (split) {
+        _sh_split(tree, shard);
+    }
+    return added;
+}
+
+bool sh_remove(sh_Tree *tree, void *data) {
+    sh_Shard *shard = _sh_lock(tree, data, true);
+    bt_Node *node = bt_find(shard->tree, data);
+    bool removed = node != NULL;
+    if (removed) {
+        void *stored = node->data;
+        bt_remove_node(shard->tree, node);
+        if (shard->low == stored) {
+            shard->pinned = true;
+        } else {
+            tree->delete (stored);
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return removed;
+}
+
+void *sh_find(sh_Tree *tree, void *data) {
+    sh_Shard *shard = _sh_lock(tree, data, false);
+    bt_Node *node = bt_find(shard->tree, data);
+    void *found = node != NULL ? node->data : NULL;
+    pthread_rwlock_unlock(&shard->lock);
+    return found;
+}
+
+int sh_foreach(sh_Tree *tree, int (*fn)(void *data, void *ctx), void *ctx) {
+    int result = 0;
+    // the shards are walked by their bounds, only the lock of the shard being walked is held
+    sh_Shard *shard = _sh_lock(tree, NULL, false);
+    while (true) {
+        bt_Node *node;
+        for (node = bt_first(shard->tree); node != NULL && result == 0; node = bt_next(node)) {
+            result = fn(node->data, ctx);
+        }
+        void *high = shard->high;
+        pthread_rwlock_unlock(&shard->lock);
+        if (high == NULL || result != 0) {
+            return result;
+        }
+        shard = _sh_lock(tree, high, false);
+    }
+}
+
+size_t sh_count(sh_Tree *tree) {
+    size_t count = 0;
+    sh_Shard *shard = _sh_lock(tree, NULL, false);
+    while (true) {
+        count += shard->tree->count;
+        void *high = shard->high;
+        pthread_rwlock_unlock(&shard->lock);
+        if (high == NULL) {
+            return count;
+        }
+        shard = _sh_lock(tree, high, false);
+    }
+}
+
+void sh_delete(sh_Tree *tree) {
+    size_t idx;
+    for (idx = 0; idx < tree->shard_count; idx++) {
+        sh_Shard *shard = tree->routing->shards[idx];
+        bt_delete(shard->tree);
+        if (shard->pinned) {
+            tree->delete (shard->low);
+        }
+        pthread_rwlock_destroy(&shard->lock);
+        free(shard);
+    }
+    while (tree->routing != NULL) {
+        sh_Routing *retired = tree->routing->retired;
+        free(tree->routing);
+        tree->routing = retired;
+    }
+    pthread_mutex_destroy(&tree->splitting);
+    free(tree);
+}
+
+// helper methods implementation
+
+static sh_Shard *_sh_shard(bt_Tree *shard_tree, void *low, void *high) {
+    sh_Shard *shard = (sh_Shard *)malloc(sizeof(sh_Shard));
+    if (shard == NULL) {
+        return NULL;
+    }
+    shard->tree = shard_tree;
+    pthread_rwlock_init(&shard->lock, NULL);
+    shard->low = low;
+    shard->high = high;
+    shard->pinned = false;
+    return shard;
+}
+
+// allocates a routing table with its arrays in one block
+static sh_Routing *_sh_routing(size_t capacity) {
+    sh_Routing *routing =
+        (sh_Routing *)malloc(sizeof(sh_Routing) + capacity * (sizeof(sh_Shard *) + sizeof(void *)));
+    if (routing == NULL) {
+        return NULL;
+    }
+    routing->capacity = capacity;
+    routing->retired = NULL;
+    routing->shards = (sh_Shard **)(routing + 1);
+    routing->bounds = (void **)(routing->shards + capacity);
+    return routing;
+}
+
+// routes data to its shard and locks it, NULL routes to the first shard. The routing table is read
+// optimistically and routed again if a split changed it, the lock taken is the only write.
+static sh_Shard *_sh_lock(sh_Tree *tree, void *data, bool write) {
+    while (true) {
+        size_t sequence = __atomic_load_n(&tree->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) {
+            continue;
+        }
+        sh_Routing *routing = __atomic_load_n(&tree->routing, __ATOMIC_ACQUIRE);
+        size_t count = __atomic_load_n(&tree->shard_count, __ATOMIC_RELAXED);
+        if (count > routing->capacity) {
+            continue;
+        }
+        size_t idx = data != NULL ? _sh_route(tree, routing, count, data) : 0;
+        sh_Shard *shard = __atomic_load_n(&routing->shards[idx], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&tree->sequence, __ATOMIC_RELAXED) != sequence) {
+            continue;
+        }
+
+        if (write) {
+            pthread_rwlock_wrlock(&shard->lock);
+        } else {
+            pthread_rwlock_rdlock(&shard->lock);
+        }
+        // a split may have moved data to a new shard before the lock was taken
+        if (data == NULL || shard->high == NULL || tree->compare(data, shard->high) < 0) {
+            return shard;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+// index of the shard whose key range holds data among the first count shards of routing. Split
+// keys are only deleted with the tree, so even a table changed meanwhile compares live data.
+static size_t _sh_route(sh_Tree *tree, sh_Routing *routing, size_t count, void *data) {
+    size_t lo = 0;
+    size_t hi = count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tree->compare(__atomic_load_n(&routing->bounds[mid], __ATOMIC_RELAXED), data) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void _sh_split(sh_Tree *tree, sh_Shard *shard) {
+    pthread_mutex_lock(&tree->splitting);
+    pthread_rwlock_wrlock(&shard->lock);
+    // another thread may have split the shard while it was unlocked
+    if (shard->tree->count <= tree->split_size) {
+        pthread_rwlock_unlock(&shard->lock);
+        pthread_mutex_unlock(&tree->splitting);
+        return;
+    }
+
+    // everything is allocated up front, running out of memory leaves the shard as it is
+    sh_Routing *routing = tree->routing;
+    sh_Routing *grown = NULL;
+    if (tree->shard_count == routing->capacity) {
+        grown = _sh_routing(routing->capacity * 2);
+    }
+    void *median = _sh_median(shard->tree);
+    sh_Shard *created = _sh_shard(NULL, median, shard->high);
+    bt_Tree *lt = NULL;
+    bt_Tree *ge = NULL;
+    if (created != NULL && (grown != NULL || tree->shard_count < routing->capacity)) {
+        bt_split(shard->tree, median, &lt, &ge);
+    }
+    if (lt == NULL) {
+        if (created != NULL) {
+            pthread_rwlock_destroy(&created->lock);
+        }
+        free(created);
+        free(grown);
+        pthread_rwlock_unlock(&shard->lock);
+        pthread_mutex_unlock(&tree->splitting);
+        return;
+    }
+    bt_delete(shard->tree);
+    shard->tree = lt;
+    created->tree = ge;
+
+    size_t idx = 0;
+    while (routing->shards[idx] != shard) {
+        idx++;
+    }
+    size_t sequence = tree->sequence;
+    __atomic_store_n(&tree->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (grown != NULL) {
+        memcpy(grown->shards, routing->shards, tree->shard_count * sizeof(sh_Shard *));
+        memcpy(grown->bounds, routing->bounds, (tree->shard_count - 1) * sizeof(void *));
+        grown->retired = routing;
+        __atomic_store_n(&tree->routing, grown, __ATOMIC_RELEASE);
+        routing = grown;
+    }
+    size_t moved;
+    for (moved = tree->shard_count; moved > idx + 1; moved--) {
+        __atomic_store_n(&routing->shards[moved], routing->shards[moved - 1], __ATOMIC_RELAXED);
+        __atomic_store_n(&routing->bounds[moved - 1], routing->bounds[moved - 2], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&routing->shards[idx + 1], created, __ATOMIC_RELAXED);
+    __atomic_store_n(&routing->bounds[idx], median, __ATOMIC_RELAXED);
+    __atomic_store_n(&tree->shard_count, tree->shard_count + 1, __ATOMIC_RELAXED);
+    shard->high = median;
+    __atomic_store_n(&tree->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&shard->lock);
+    pthread_mutex_unlock(&tree->splitting);
+}
+
+// data in the middle of the order of shard_tree, found through the subtree sizes
+static void *_sh_median(bt_Tree *shard_tree) {
+    bt_Node *node = shard_tree->root;
+    size_t rank = shard_tree->count / 2;
+    while (true) {
+        size_t left = node->left != NULL ? node->left->size : 0;
+        if (rank < left) {
+            node = node->left;
+        } else if (rank > left) {
+            rank -= left + 1;
+            node = node->right;
+        } else {
+            return node->data;
+        }
+    }
+}
+#endif // _SHARDED_TREE_IMPL_
+#endif // BINARY_TREE_IMPLEMENTATION
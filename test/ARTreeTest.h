@@ -0,0 +1,118 @@
+#include "ARTree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctest.h"
+
+static int _art_count_until(void *data, void *ctx) {
+    (void)data;
+    int *left = (int *)ctx;
+    return --*left == 0;
+}
+
+CTEST(arttest, add_find) {
+    art_Tree *tree = art_create(art_key_str, ART_NO_DELETE);
+    char *words[] = {"romane", "romanus", "romulus", "rubens", "ruber", "rubicon", "rubicundus",
+                     "rub",    "r",       ""};
+    int count = sizeof(words) / sizeof(words[0]);
+
+    for (int idx = 0; idx < count; idx++) {
+        ASSERT_TRUE(art_add(tree, words[idx]));
+    }
+    ASSERT_FALSE(art_add(tree, "rubens"));
+    ASSERT_EQUAL(tree->count, count);
+
+    for (int idx = 0; idx < count; idx++) {
+        ASSERT_TRUE(art_find(tree, words[idx]) == words[idx]);
+    }
+    ASSERT_NULL(art_find(tree, "ru"));
+    ASSERT_NULL(art_find(tree, "rubicundusx"));
+    ASSERT_TRUE(art_find_key(tree, (const unsigned char *)"rubens", 6) == words[3]);
+
+    void **list;
+    art_traverse(tree, &list);
+    for (int idx = 1; idx < count; idx++) {
+        ASSERT_TRUE(strcmp((char *)list[idx - 1], (char *)list[idx]) < 0);
+    }
+    free(list);
+
+    int left = 3;
+    ASSERT_EQUAL(art_foreach(tree, _art_count_until, &left), 1);
+    ASSERT_EQUAL(left, 0);
+
+    art_delete(tree);
+}
+
+CTEST(arttest, grow_shrink) {
+    art_Tree *tree = art_create(art_key_str, ART_TRIVIAL_DELETE);
+    // long shared prefixes exceed the stored prefix, all byte values fill a Node256
+    for (int idx = 0; idx < 1000; idx++) {
+        char *key = (char *)malloc(32);
+        sprintf(key, "shared-prefix-of-keys/%d", idx * 7919 % 1000);
+        ASSERT_TRUE(art_add(tree, key));
+    }
+    for (int idx = 1; idx < 256; idx++) {
+        char *key = (char *)malloc(2);
+        key[0] = (char)idx;
+        key[1] = 0;
+        ASSERT_TRUE(art_add(tree, key));
+    }
+    ASSERT_EQUAL(tree->count, 1255);
+
+    char key[32];
+    for (int idx = 0; idx < 1000; idx += 2) {
+        sprintf(key, "shared-prefix-of-keys/%d", idx);
+        void *found = art_find(tree, key);
+        ASSERT_NOT_NULL(found);
+        ASSERT_TRUE(art_remove(tree, key));
+        free(found);
+    }
+    for (int idx = 1; idx < 256; idx++) {
+        key[0] = (char)idx;
+        key[1] = 0;
+        void *found = art_find(tree, key);
+        ASSERT_NOT_NULL(found);
+        ASSERT_TRUE(art_remove(tree, key));
+        free(found);
+    }
+    ASSERT_FALSE(art_remove(tree, "shared-prefix-of-keys/0"));
+    ASSERT_EQUAL(tree->count, 500);
+
+    for (int idx = 0; idx < 1000; idx++) {
+        sprintf(key, "shared-prefix-of-keys/%d", idx);
+        ASSERT_EQUAL(art_find(tree, key) != NULL, idx % 2 == 1);
+    }
+
+    art_delete(tree);
+}
+
+CTEST(arttest, odd_address) {
+    art_Tree *tree = art_create(art_key_str, ART_NO_DELETE);
+    // keys packed at odd offsets of one buffer, their addresses have the lowest bit set
+    char buf[64] = {0};
+    char *words[] = {buf + 1, buf + 5, buf + 11, buf + 17, buf + 23};
+    strcpy(words[0], "ab");
+    strcpy(words[1], "abcd");
+    strcpy(words[2], "abce");
+    strcpy(words[3], "b");
+    strcpy(words[4], "");
+    int count = sizeof(words) / sizeof(words[0]);
+
+    for (int idx = 0; idx < count; idx++) {
+        ASSERT_TRUE(((uintptr_t)words[idx] & 1) == 1);
+        ASSERT_TRUE(art_add(tree, words[idx]));
+    }
+    for (int idx = 0; idx < count; idx++) {
+        ASSERT_TRUE(art_find(tree, words[idx]) == words[idx]);
+    }
+    ASSERT_NULL(art_find(tree, "abc"));
+
+    ASSERT_TRUE(art_remove(tree, "abcd"));
+    ASSERT_TRUE(art_remove(tree, ""));
+    ASSERT_EQUAL(tree->count, count - 2);
+    ASSERT_TRUE(art_find(tree, "abce") == words[2]);
+    ASSERT_NULL(art_find(tree, "abcd"));
+
+    art_delete(tree);
+}
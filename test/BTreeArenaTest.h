@@ -0,0 +1,62 @@
+#include "BTreeArena.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ctest.h"
+
+CTEST(arenatest, use_arena) {
+    bt_Arena *arena = bt_arena_create();
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    tree->balance = SCAPEGOAT_BALANCE;
+    ASSERT_TRUE(bt_use_arena(tree, arena));
+    int values[60000];
+    int idx;
+    for (idx = 0; idx < 60000; idx++) {
+        values[idx] = idx * 7919 % 60000;
+        bt_add(tree, &values[idx]);
+    }
+    ASSERT_EQUAL(arena->used, 60000);
+    ASSERT_TRUE(arena->region_count > 1);
+    ASSERT_EQUAL((uintptr_t)arena->regions[0] % BT_ARENA_REGION, 0);
+    double coverage = bt_arena_coverage(arena);
+    ASSERT_TRUE(coverage >= 0 && coverage <= 1);
+
+    // freed nodes are reused before new slots are carved
+    size_t regions = arena->region_count;
+    for (idx = 0; idx < 60000; idx += 2) {
+        bt_remove(tree, &values[idx]);
+    }
+    ASSERT_EQUAL(arena->used, 30000);
+    for (idx = 0; idx < 60000; idx += 2) {
+        bt_add(tree, &values[idx]);
+    }
+    ASSERT_EQUAL(arena->region_count, regions);
+    ASSERT_TRUE(_arena_alloc(arena->slot_size + 1, arena) == NULL);
+
+    // trees of other node sizes or allocators do not mix
+    bt_Tree *map = bt_create_map(_cmp_int, sizeof(int), BT_NO_DELETE);
+    ASSERT_FALSE(bt_use_arena(map, arena));
+    bt_Tree *other = bt_create_int(BT_NO_DELETE);
+    ASSERT_FALSE(bt_join(tree, other));
+    // nodes kept in a small block are not allocated by the tree, it cannot switch to the arena
+    bt_Tree *small = bt_create_int(BT_NO_DELETE);
+    small->small_max = 4;
+    ASSERT_TRUE(bt_add(small, &values[0]));
+    ASSERT_NOT_NULL(small->small);
+    ASSERT_FALSE(bt_use_arena(small, arena));
+    bt_delete(small);
+
+    bt_Tree *lt;
+    bt_Tree *ge;
+    bt_split(tree, &values[1], &lt, &ge);
+    ASSERT_TRUE(bt_join(lt, ge));
+    ASSERT_EQUAL(lt->count, 60000);
+
+    bt_delete(other);
+    bt_delete(map);
+    bt_delete(ge);
+    bt_delete(lt);
+    bt_delete(tree);
+    ASSERT_EQUAL(arena->used, 0);
+    bt_arena_delete(arena);
+}
@@ -0,0 +1,109 @@
+#include "BTreeLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+static const void *_serialize_int(void *data, size_t *len) {
+    *len = sizeof(int);
+    return data;
+}
+
+static void *_deserialize_int(const void *bytes, size_t len) {
+    (void)len;
+    int *data = (int *)malloc(sizeof(int));
+    memcpy(data, bytes, sizeof(int));
+    return data;
+}
+
+CTEST(logtest, recover) {
+    char path[64];
+    char file[80];
+    sprintf(path, "/tmp/bt_log_test_%d", (int)getpid());
+
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    bt_Log *log = bt_log_open(tree, path, _serialize_int, 8, 0);
+    ASSERT_NOT_NULL(log);
+
+    int values[100];
+    int idx;
+    for (idx = 0; idx < 100; idx++) {
+        values[idx] = idx;
+        ASSERT_TRUE(bt_log_add(log, &values[idx]));
+    }
+    ASSERT_TRUE(bt_log_checkpoint(log));
+    for (idx = 0; idx < 100; idx += 3) {
+        ASSERT_TRUE(bt_log_remove(log, &values[idx]));
+    }
+    ASSERT_FALSE(bt_log_remove(log, &values[0]));
+    ASSERT_TRUE(bt_log_close(log));
+
+    // a torn record at the end of the log is ignored
+    sprintf(file, "%s.log", path);
+    FILE *torn = fopen(file, "ab");
+    fwrite("torn", 1, 4, torn);
+    fclose(torn);
+
+    bt_Tree *recovered = bt_create_int(BT_TRIVIAL_DELETE);
+    ASSERT_TRUE(bt_recover(recovered, path, _deserialize_int));
+    ASSERT_EQUAL(recovered->count, tree->count);
+    ASSERT_FALSE(bt_recover(recovered, path, _deserialize_int));
+
+    bt_Node *node;
+    bt_Node *other = bt_first(recovered);
+    for (node = bt_first(tree); node != NULL; node = bt_next(node)) {
+        ASSERT_EQUAL(*(int *)other->data, *(int *)node->data);
+        other = bt_next(other);
+    }
+    ASSERT_NULL(other);
+
+    // running out of memory fails the recovery, the data not kept is deleted
+    bt_Tree *starved = bt_create_int(BT_TRIVIAL_DELETE);
+    size_t budget = 10;
+    ASSERT_TRUE(bt_set_allocator(starved, _budget_alloc, _budget_free, &budget));
+    ASSERT_FALSE(bt_recover(starved, path, _deserialize_int));
+    ASSERT_EQUAL(starved->count, 10);
+    bt_delete(starved);
+
+    bt_delete(recovered);
+    bt_delete(tree);
+    unlink(file);
+    sprintf(file, "%s.ckpt", path);
+    unlink(file);
+}
+
+CTEST(logtest, recover_multiset) {
+    char path[64];
+    char file[80];
+    sprintf(path, "/tmp/bt_log_multi_%d", (int)getpid());
+
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    tree->multiset = true;
+    bt_Log *log = bt_log_open(tree, path, _serialize_int, 8, 0);
+    ASSERT_NOT_NULL(log);
+
+    int values[] = {7, 7, 7, 8};
+    int idx;
+    for (idx = 0; idx < 4; idx++) {
+        ASSERT_TRUE(bt_log_add(log, &values[idx]));
+    }
+    ASSERT_TRUE(bt_log_remove(log, &values[0]));
+    ASSERT_TRUE(bt_log_close(log));
+
+    // equal data only counts up the node, the replayed copies are deleted
+    bt_Tree *recovered = bt_create_int(BT_TRIVIAL_DELETE);
+    recovered->multiset = true;
+    ASSERT_TRUE(bt_recover(recovered, path, _deserialize_int));
+    ASSERT_EQUAL(recovered->count, 2);
+    ASSERT_EQUAL(bt_multiplicity(recovered, &values[0]), 2);
+    ASSERT_EQUAL(bt_multiplicity(recovered, &values[3]), 1);
+
+    bt_delete(recovered);
+    bt_delete(tree);
+    sprintf(file, "%s.log", path);
+    unlink(file);
+    sprintf(file, "%s.ckpt", path);
+    unlink(file);
+}
@@ -0,0 +1,63 @@
+#include "BTreeReplica.h"
+#include <stdlib.h>
+
+#include "ctest.h"
+
+CTEST(replicatest, replicate) {
+    bt_Tree *tree = bt_create_map(_cmp_int, sizeof(int), BT_NO_DELETE);
+    ASSERT_EQUAL(bt_enable_filter(tree, _hash_value, 100), BT_OK);
+    int values[100];
+    int idx;
+    for (idx = 0; idx < 100; idx++) {
+        values[idx] = idx * 37 % 100;
+        bt_put(tree, &values[idx], &values[idx], NULL);
+    }
+
+    bt_Replicas *replicas = bt_replicate(tree);
+    ASSERT_TRUE(replicas->count >= 1);
+    bt_Tree *local = bt_replica_local(replicas);
+    ASSERT_EQUAL(local->count, 100);
+    ASSERT_EQUAL(local->root->height, tree->root->height);
+
+    // nodes and inline keys live in the block of the replica
+    char *block = (char *)local;
+    bt_Node *node;
+    for (node = bt_first(local); node != NULL; node = bt_next(node)) {
+        char *key = (char *)node->data;
+        ASSERT_TRUE((char *)node > block && (char *)node < block + replicas->block_size);
+        ASSERT_TRUE(key > block && key < block + replicas->block_size);
+    }
+    for (idx = 0; idx < 100; idx++) {
+        ASSERT_EQUAL(*(int *)bt_get(local, &idx), idx);
+    }
+    int absent = 100;
+    ASSERT_NULL(bt_find(local, &absent));
+
+    bt_replicas_delete(replicas);
+    bt_delete(tree);
+}
+
+CTEST(replicatest, interval) {
+    Interval intervals[] = {{1, 3}, {2, 20}, {5, 6}, {7, 9}, {10, 12}, {11, 11}, {15, 18}};
+    size_t idx;
+    bt_Tree *tree = bt_create_map(_cmp_interval, sizeof(Interval), BT_NO_DELETE);
+    ASSERT_TRUE(bt_enable_interval(tree, _interval_low, _interval_high, _cmp_int));
+    for (idx = 0; idx < sizeof(intervals) / sizeof(intervals[0]); idx++) {
+        bt_put(tree, &intervals[idx], NULL, NULL);
+    }
+
+    // greatest high endpoints point into the inline keys of the replica, not of tree
+    bt_Replicas *replicas = bt_replicate(tree);
+    bt_Tree *local = bt_replica_local(replicas);
+    char *block = (char *)local;
+    char *max_high = (char *)*_max_high(local, local->root);
+    ASSERT_TRUE(max_high > block && max_high < block + replicas->block_size);
+    ASSERT_EQUAL(*(int *)max_high, 20);
+
+    bt_delete(tree);
+    int lo = 11;
+    int hi = 11;
+    int sum = 0;
+    ASSERT_EQUAL(bt_overlaps(local, &lo, &hi, _count_hit, &sum), 3);
+    bt_replicas_delete(replicas);
+}
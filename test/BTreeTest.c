@@ -1,4 +1,11 @@
 #include "BTreeTest.h"
+#include "ARTreeTest.h"
+#include "CompactTreeTest.h"
+#include "LSMTreeTest.h"
+#include "BTreeLogTest.h"
+#include "ShardedTreeTest.h"
+#include "BTreeReplicaTest.h"
+#include "BTreeArenaTest.h"
 
 int main(int argc, const char *argv[]) {
     int result = ctest_main(argc, argv);
@@ -4,6 +4,7 @@
 #define BINARY_TREE_IMPLEMENTATION
 #include "BTree.h"
 #include <stdlib.h>
+#include <string.h>
 
 #include "ctest.h"
 
@@ -69,6 +70,7 @@ CTEST2(bttest, remove_root) {
 
     ASSERT_EQUAL(data->tree->count, 3);
     bt_remove(data->tree, val);
+    root = data->tree->root;
     ASSERT_EQUAL(data->tree->count, 2);
     ASSERT_EQUAL(*(int *)root->data, 3);
     ASSERT_EQUAL(*(int *)root->right->data, 5);
@@ -91,6 +93,391 @@ CTEST2(bttest, remove_root_2) {
     ASSERT_EQUAL(*(int *)root->right->data, 5);
 }
 
+CTEST2(bttest, remove_keeps_order) {
+    int values[] = {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7};
+    size_t idx;
+    for (idx = 0; idx < sizeof(values) / sizeof(values[0]); idx++) {
+        bt_add(data->tree, &values[idx]);
+    }
+
+    bt_Node *kept = bt_find(data->tree, &values[5]);
+    ASSERT_TRUE(bt_remove(data->tree, &values[1]));
+    ASSERT_TRUE(bt_remove(data->tree, &values[0]));
+    ASSERT_FALSE(bt_remove(data->tree, &values[0]));
+    ASSERT_TRUE(kept == bt_find(data->tree, &values[5]));
+    ASSERT_EQUAL(*(int *)kept->data, 10);
+
+    bt_Node **traversal = NULL;
+    bt_traverse(data->tree, IN_ORDER, &traversal);
+    ASSERT_EQUAL(data->tree->count, 9);
+    for (idx = 1; idx < data->tree->count; idx++) {
+        ASSERT_TRUE(*(int *)traversal[idx - 1]->data < *(int *)traversal[idx]->data);
+    }
+    free(traversal);
+}
+
+CTEST2(bttest, remove_node) {
+    int values[] = {4, 3, 5, 1};
+    size_t idx;
+    for (idx = 0; idx < sizeof(values) / sizeof(values[0]); idx++) {
+        bt_add(data->tree, &values[idx]);
+    }
+
+    bt_Node *node = bt_find(data->tree, &values[0]);
+    ASSERT_NOT_NULL(node);
+    ASSERT_TRUE(bt_remove_node(data->tree, node));
+    ASSERT_EQUAL(data->tree->count, 3);
+    ASSERT_NULL(bt_find(data->tree, &values[0]));
+    ASSERT_NOT_NULL(bt_find(data->tree, &values[3]));
+}
+
+CTEST2(bttest, next_prev) {
+    int values[16];
+    int idx;
+    for (idx = 0; idx < 16; idx++) {
+        values[idx] = idx;
+        bt_add(data->tree, &values[idx]);
+    }
+    bt_remove(data->tree, &values[7]);
+    bt_remove(data->tree, &values[0]);
+
+    int expected = 1;
+    bt_Node *node;
+    for (node = bt_first(data->tree); node != NULL; node = bt_next(node)) {
+        if (expected == 7) {
+            expected++;
+        }
+        ASSERT_EQUAL(*(int *)node->data, expected);
+        if (node->parent != NULL) {
+            ASSERT_TRUE(node->parent->left == node || node->parent->right == node);
+        } else {
+            ASSERT_TRUE(data->tree->root == node);
+        }
+        expected++;
+    }
+    ASSERT_EQUAL(expected, 16);
+
+    for (node = bt_last(data->tree); node != NULL; node = bt_prev(node)) {
+        expected--;
+        if (expected == 7) {
+            expected--;
+        }
+        ASSERT_EQUAL(*(int *)node->data, expected);
+    }
+    ASSERT_EQUAL(expected, 1);
+}
+
+CTEST2(bttest, bounds) {
+    int values[] = {10, 20, 30, 40};
+    size_t idx;
+    for (idx = 0; idx < sizeof(values) / sizeof(values[0]); idx++) {
+        bt_add(data->tree, &values[idx]);
+    }
+
+    int key = 20;
+    ASSERT_EQUAL(*(int *)bt_lower_bound(data->tree, &key)->data, 20);
+    ASSERT_EQUAL(*(int *)bt_upper_bound(data->tree, &key)->data, 30);
+    key = 25;
+    ASSERT_EQUAL(*(int *)bt_lower_bound(data->tree, &key)->data, 30);
+    ASSERT_EQUAL(*(int *)bt_upper_bound(data->tree, &key)->data, 30);
+    key = 40;
+    ASSERT_NULL(bt_upper_bound(data->tree, &key));
+    key = 5;
+    ASSERT_EQUAL(*(int *)bt_lower_bound(data->tree, &key)->data, 10);
+}
+
+CTEST2(bttest, split_join) {
+    int values[32];
+    int idx;
+    for (idx = 0; idx < 32; idx++) {
+        values[idx] = idx;
+        bt_add(data->tree, &values[idx]);
+    }
+
+    bt_Tree *lt = NULL;
+    bt_Tree *ge = NULL;
+    bt_split(data->tree, &values[11], &lt, &ge);
+    ASSERT_EQUAL(data->tree->count, 0);
+    ASSERT_EQUAL(lt->count, 11);
+    ASSERT_EQUAL(ge->count, 21);
+    ASSERT_EQUAL(*(int *)bt_last(lt)->data, 10);
+    ASSERT_EQUAL(*(int *)bt_first(ge)->data, 11);
+    ASSERT_TRUE(bt_is_balanced(lt));
+    ASSERT_TRUE(bt_is_balanced(ge));
+
+    ASSERT_FALSE(bt_join(ge, lt));
+    ASSERT_TRUE(bt_join(lt, ge));
+    ASSERT_EQUAL(lt->count, 32);
+    ASSERT_EQUAL(ge->count, 0);
+    ASSERT_TRUE(bt_is_balanced(lt));
+
+    bt_delete(lt);
+    bt_delete(ge);
+}
+
+CTEST2(bttest, set_operations) {
+    int values[12];
+    int idx;
+    bt_Tree *evens = bt_create_int(BT_NO_DELETE);
+    bt_Tree *thirds = bt_create_int(BT_NO_DELETE);
+    bt_Tree *other = bt_create_int(BT_NO_DELETE);
+    for (idx = 0; idx < 12; idx++) {
+        values[idx] = idx;
+        bt_add(data->tree, &values[idx]);
+        if (idx % 2 == 0) {
+            bt_add(evens, &values[idx]);
+        }
+        if (idx % 3 == 0) {
+            bt_add(thirds, &values[idx]);
+            bt_add(other, &values[idx]);
+        }
+    }
+
+    // {0, 2, 4, 6, 8, 10} | {0, 3, 6, 9}
+    ASSERT_TRUE(bt_union(evens, thirds));
+    ASSERT_EQUAL(evens->count, 8);
+    ASSERT_EQUAL(thirds->count, 0);
+    ASSERT_NOT_NULL(bt_find(evens, &values[9]));
+
+    // {0, 2, 3, 4, 6, 8, 9, 10} & {0, 3, 6, 9}
+    ASSERT_TRUE(bt_intersect(evens, other));
+    ASSERT_EQUAL(evens->count, 4);
+    ASSERT_NULL(bt_find(evens, &values[2]));
+
+    // {0 .. 11} - {0, 3, 6, 9}
+    ASSERT_TRUE(bt_difference(data->tree, evens));
+    ASSERT_EQUAL(data->tree->count, 8);
+    ASSERT_NULL(bt_find(data->tree, &values[6]));
+    ASSERT_NOT_NULL(bt_find(data->tree, &values[7]));
+    ASSERT_TRUE(bt_is_balanced(data->tree));
+
+    bt_delete(evens);
+    bt_delete(thirds);
+    bt_delete(other);
+}
+
+CTEST2(bttest, multiset) {
+    int values[] = {4, 3, 4, 5, 4};
+    size_t idx;
+    data->tree->multiset = true;
+    for (idx = 0; idx < sizeof(values) / sizeof(values[0]); idx++) {
+        ASSERT_TRUE(bt_add(data->tree, &values[idx]));
+    }
+
+    ASSERT_EQUAL(data->tree->count, 3);
+    ASSERT_EQUAL(bt_multiplicity(data->tree, &values[0]), 3);
+    ASSERT_TRUE(bt_remove(data->tree, &values[0]));
+    ASSERT_TRUE(bt_remove(data->tree, &values[0]));
+    ASSERT_EQUAL(bt_multiplicity(data->tree, &values[0]), 1);
+    ASSERT_TRUE(bt_remove(data->tree, &values[0]));
+    ASSERT_EQUAL(bt_multiplicity(data->tree, &values[0]), 0);
+    ASSERT_EQUAL(data->tree->count, 2);
+}
+
+static void *_keep_greater(void *existing, void *data) {
+    return data > existing ? data : existing;
+}
+
+CTEST2(bttest, add_or_update) {
+    int values[] = {4, 3, 4};
+    ASSERT_TRUE(bt_add_or_update(data->tree, &values[0], _keep_greater));
+    ASSERT_TRUE(bt_add_or_update(data->tree, &values[1], _keep_greater));
+    ASSERT_FALSE(bt_add_or_update(data->tree, &values[2], _keep_greater));
+    ASSERT_EQUAL(data->tree->count, 2);
+    ASSERT_TRUE(bt_find(data->tree, &values[0])->data == &values[2]);
+}
+
+CTEST(bttest, map) {
+    bt_Tree *map = bt_create_map(_cmp_int, sizeof(int), BT_TRIVIAL_DELETE);
+    int key = 7;
+    void *old = NULL;
+
+    ASSERT_TRUE(bt_put(map, &key, strdup("seven"), &old));
+    ASSERT_NULL(old);
+    key = 3;
+    ASSERT_TRUE(bt_put(map, &key, strdup("three"), NULL));
+    key = 7;
+    ASSERT_FALSE(bt_put(map, &key, strdup("SEVEN"), &old));
+    ASSERT_STR("seven", (char *)old);
+    free(old);
+
+    // keys are copied into the nodes
+    key = 100;
+    int lookup = 7;
+    ASSERT_STR("SEVEN", (char *)bt_get(map, &lookup));
+    lookup = 3;
+    ASSERT_STR("three", (char *)bt_get(map, &lookup));
+    ASSERT_TRUE(bt_find(map, &lookup)->data != &lookup);
+    ASSERT_NULL(bt_get(map, &key));
+    ASSERT_EQUAL(map->count, 2);
+
+    bt_delete(map);
+}
+
+typedef struct {
+    int low;
+    int high;
+} Interval;
+
+static int _cmp_interval(void *d1, void *d2) {
+    Interval *i1 = (Interval *)d1;
+    Interval *i2 = (Interval *)d2;
+    int cmp_result = _cmp_int(&i1->low, &i2->low);
+    return cmp_result != 0 ? cmp_result : _cmp_int(&i1->high, &i2->high);
+}
+
+static void *_interval_low(void *data) { return &((Interval *)data)->low; }
+
+static void *_interval_high(void *data) { return &((Interval *)data)->high; }
+
+static void _count_hit(bt_Node *node, void *ctx) { *(int *)ctx += ((Interval *)node->data)->low; }
+
+CTEST(bttest, interval) {
+    Interval intervals[] = {{1, 3}, {2, 20}, {5, 6}, {7, 9}, {10, 12}, {11, 11}, {15, 18}};
+    size_t idx;
+    bt_Tree *tree = bt_create(_cmp_interval, BT_NO_DELETE);
+    ASSERT_TRUE(bt_enable_interval(tree, _interval_low, _interval_high, _cmp_int));
+    for (idx = 0; idx < sizeof(intervals) / sizeof(intervals[0]); idx++) {
+        bt_add(tree, &intervals[idx]);
+    }
+    // the layout of the nodes is fixed once the tree holds any
+    ASSERT_FALSE(bt_enable_prefix(tree, bt_prefix_str));
+    ASSERT_EQUAL(_node_size(tree), sizeof(bt_Node) + sizeof(void *));
+
+    int lo = 11;
+    int hi = 11;
+    int sum = 0;
+    ASSERT_EQUAL(bt_overlaps(tree, &lo, &hi, _count_hit, &sum), 3);
+    ASSERT_EQUAL(sum, 2 + 10 + 11);
+
+    lo = 4;
+    hi = 7;
+    sum = 0;
+    ASSERT_EQUAL(bt_overlaps(tree, &lo, &hi, _count_hit, &sum), 3);
+    ASSERT_EQUAL(sum, 2 + 5 + 7);
+
+    bt_remove(tree, &intervals[1]);
+    lo = 13;
+    hi = 14;
+    ASSERT_EQUAL(bt_overlaps(tree, &lo, &hi, _count_hit, &sum), 0);
+    ASSERT_EQUAL(*(int *)*_max_high(tree, tree->root), 18);
+
+    bt_delete(tree);
+}
+
+static void _lift_value(bt_Node *node, void *out) { *(long *)out = *(int *)*bt_node_value(node); }
+
+static void _sum(void *out, const void *a, const void *b) {
+    *(long *)out = *(const long *)a + *(const long *)b;
+}
+
+CTEST(bttest, range_aggregate) {
+    static const long zero = 0;
+    int keys[64];
+    int volumes[64];
+    int idx;
+    bt_Tree *map = bt_create_map(_cmp_int, sizeof(int), BT_NO_DELETE);
+    ASSERT_TRUE(bt_enable_aggregate(map, sizeof(long), _lift_value, _sum, &zero));
+    for (idx = 0; idx < 64; idx++) {
+        keys[idx] = idx * 2;
+        volumes[idx] = idx;
+        bt_put(map, &keys[idx], &volumes[idx], NULL);
+    }
+    ASSERT_FALSE(bt_enable_aggregate(map, sizeof(long), _lift_value, _sum, &zero));
+    ASSERT_EQUAL(*(long *)bt_node_aggregate(map, map->root), 63 * 64 / 2);
+
+    // keys 10 .. 20 hold the volumes 5 .. 10
+    int lo = 9;
+    int hi = 20;
+    long sum = -1;
+    ASSERT_TRUE(bt_range_aggregate(map, &lo, &hi, &sum));
+    ASSERT_EQUAL(sum, 5 + 6 + 7 + 8 + 9 + 10);
+
+    bt_remove(map, &keys[7]);
+    bt_put(map, &keys[8], &volumes[0], NULL);
+    ASSERT_TRUE(bt_range_aggregate(map, &lo, &hi, &sum));
+    ASSERT_EQUAL(sum, 5 + 6 + 0 + 9 + 10);
+
+    lo = 200;
+    hi = 300;
+    ASSERT_TRUE(bt_range_aggregate(map, &lo, &hi, &sum));
+    ASSERT_EQUAL(sum, 0);
+
+    bt_delete(map);
+}
+
+static void _lift_count(bt_Node *node, void *out) {
+    (void)node;
+    *(int *)out = 1;
+}
+
+static void _sum_int(void *out, const void *a, const void *b) {
+    *(int *)out = *(const int *)a + *(const int *)b;
+}
+
+CTEST(bttest, range_aggregate_int) {
+    // aggregates smaller than a word are only padded inside the nodes, identity and out keep
+    // their size
+    static const int zero = 0;
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    ASSERT_TRUE(bt_enable_aggregate(tree, sizeof(int), _lift_count, _sum_int, &zero));
+    int values[32];
+    int idx;
+    for (idx = 0; idx < 32; idx++) {
+        values[idx] = idx;
+        bt_add(tree, &values[idx]);
+    }
+    int lo = 40;
+    int hi = 50;
+    int count = -1;
+    ASSERT_TRUE(bt_range_aggregate(tree, &lo, &hi, &count));
+    ASSERT_EQUAL(count, 0);
+    lo = 3;
+    hi = 12;
+    ASSERT_TRUE(bt_range_aggregate(tree, &lo, &hi, &count));
+    ASSERT_EQUAL(count, 10);
+    ASSERT_EQUAL(*(int *)bt_node_aggregate(tree, tree->root), 32);
+    bt_delete(tree);
+}
+
+static int _cmp_str_counted(void *d1, void *d2) {
+    static int calls = 0;
+    if (d1 == NULL) {
+        return calls;
+    }
+    calls++;
+    return strcmp((char *)d1, (char *)d2);
+}
+
+CTEST(bttest, prefix) {
+    char *words[] = {"lorem ipsum", "lorem ipsum dolor", "consectetur", "adipiscing", "elit",
+                     "lorem ipsum amet"};
+    size_t idx;
+    bt_Tree *tree = bt_create(_cmp_str_counted, BT_NO_DELETE);
+    bt_enable_prefix(tree, bt_prefix_str);
+    ASSERT_TRUE(bt_prefix_str("a") < bt_prefix_str("ab"));
+    ASSERT_TRUE(bt_prefix_str("ab") < bt_prefix_str("b"));
+
+    for (idx = 0; idx < sizeof(words) / sizeof(words[0]); idx++) {
+        bt_add(tree, words[idx]);
+    }
+
+    int calls = _cmp_str_counted(NULL, NULL);
+    ASSERT_NOT_NULL(bt_find(tree, "elit"));
+    ASSERT_NULL(bt_find(tree, "dolor"));
+    // distinct prefixes never reach the compare function
+    ASSERT_EQUAL(_cmp_str_counted(NULL, NULL), calls + 1);
+
+    ASSERT_NOT_NULL(bt_find(tree, "lorem ipsum amet"));
+    bt_Node **traversal = NULL;
+    bt_traverse(tree, IN_ORDER, &traversal);
+    for (idx = 1; idx < tree->count; idx++) {
+        ASSERT_TRUE(strcmp((char *)traversal[idx - 1]->data, (char *)traversal[idx]->data) < 0);
+    }
+    free(traversal);
+    bt_delete(tree);
+}
+
 CTEST2(bttest, traverse_pre_order) {
     int *val = (int *)calloc(1, sizeof(int));
     int *val2 = (int *)calloc(1, sizeof(int));
@@ -176,3 +563,460 @@ CTEST2(bttest, balance) {
 
     ASSERT_TRUE(bt_is_balanced(data->tree));
 }
+
+static int _check_walk(bt_Node *node, void *ctx) {
+    bt_Node ***expected = (bt_Node ***)ctx;
+    if (*(*expected)++ != node) {
+        return -1;
+    }
+    return 0;
+}
+
+static int _stop_at_tenth(bt_Node *node, void *ctx) {
+    (void)node;
+    return ++*(int *)ctx == 10 ? 10 : 0;
+}
+
+CTEST2(bttest, foreach) {
+    int values[100];
+    int idx;
+    for (idx = 0; idx < 100; idx++) {
+        values[idx] = idx * 37 % 100;
+        bt_add(data->tree, &values[idx]);
+    }
+
+    TraversalStrategy strategies[] = {PRE_ORDER, IN_ORDER, POST_ORDER};
+    for (idx = 0; idx < 3; idx++) {
+        bt_Node **traversal = NULL;
+        bt_traverse(data->tree, strategies[idx], &traversal);
+
+        bt_Node **expected = traversal;
+        ASSERT_EQUAL(bt_foreach(data->tree, strategies[idx], _check_walk, &expected), 0);
+        ASSERT_TRUE(expected == traversal + 100);
+
+        // chunks of 7 do not divide 100
+        void *chunk[7];
+        size_t len;
+        size_t read = 0;
+        bt_Node *cursor = bt_walk_first(data->tree, strategies[idx]);
+        while ((len = bt_read(&cursor, strategies[idx], chunk, 7)) > 0) {
+            for (size_t pos = 0; pos < len; pos++) {
+                ASSERT_TRUE(chunk[pos] == traversal[read + pos]->data);
+            }
+            read += len;
+        }
+        ASSERT_EQUAL(read, 100);
+        free(traversal);
+    }
+
+    int visited = 0;
+    ASSERT_EQUAL(bt_foreach(data->tree, IN_ORDER, _stop_at_tenth, &visited), 10);
+    ASSERT_EQUAL(visited, 10);
+}
+
+typedef struct {
+    char *text;
+    size_t len;
+    size_t blocks;
+} Captured;
+
+static bool _capture(const char *buffer, size_t len, void *ctx) {
+    Captured *captured = (Captured *)ctx;
+    captured->text = (char *)realloc(captured->text, captured->len + len + 1);
+    memcpy(captured->text + captured->len, buffer, len);
+    captured->len += len;
+    captured->text[captured->len] = 0;
+    captured->blocks++;
+    return true;
+}
+
+static bool _refuse(const char *buffer, size_t len, void *ctx) {
+    (void)buffer;
+    (void)len;
+    (void)ctx;
+    return false;
+}
+
+static void _dump_int(void *data, char *str) { sprintf(str, "%d", *(int *)data); }
+
+CTEST2(bttest, dump) {
+    int values[3] = {2, 1, 3};
+    int idx;
+    for (idx = 0; idx < 3; idx++) {
+        bt_add(data->tree, &values[idx]);
+    }
+
+    Captured captured = {NULL, 0, 0};
+    ASSERT_TRUE(bt_dump(data->tree, _dump_int, _capture, &captured));
+    ASSERT_STR(captured.text, "\n\t1\n2\n\t3\n");
+    ASSERT_EQUAL(captured.blocks, 1);
+    free(captured.text);
+
+    int many[1000];
+    for (idx = 0; idx < 1000; idx++) {
+        many[idx] = 10 + idx;
+        bt_add(data->tree, &many[idx]);
+    }
+    captured.text = NULL;
+    captured.len = 0;
+    captured.blocks = 0;
+    ASSERT_TRUE(bt_dump(data->tree, _dump_int, _capture, &captured));
+    ASSERT_TRUE(captured.blocks > 1);
+    ASSERT_EQUAL(captured.text[captured.len - 1], '\n');
+    free(captured.text);
+
+    ASSERT_FALSE(bt_dump(data->tree, _dump_int, _refuse, NULL));
+}
+
+static size_t compares = 0;
+
+static int _cmp_int_counted(void *d1, void *d2) {
+    compares++;
+    return _cmp_int(d1, d2);
+}
+
+static uint64_t _hash_value(void *data) { return (uint64_t)(*(int *)data); }
+
+CTEST(bttest, filter) {
+    bt_Tree *tree = bt_create(_cmp_int_counted, BT_NO_DELETE);
+    ASSERT_EQUAL(bt_enable_filter(tree, _hash_value, 500), BT_OK);
+    int values[1000];
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        values[idx] = idx;
+    }
+    for (idx = 0; idx < 500; idx++) {
+        bt_add(tree, &values[idx * 2]);
+    }
+
+    // no false negatives, most absent data is ruled out without a compare
+    for (idx = 0; idx < 1000; idx += 2) {
+        ASSERT_NOT_NULL(bt_find(tree, &values[idx]));
+    }
+    compares = 0;
+    for (idx = 1; idx < 1000; idx += 2) {
+        ASSERT_NULL(bt_find(tree, &values[idx]));
+    }
+    ASSERT_TRUE(compares < 500);
+
+    for (idx = 0; idx < 250; idx++) {
+        ASSERT_TRUE(bt_remove(tree, &values[idx * 2]));
+    }
+    ASSERT_FALSE(bt_remove(tree, &values[1]));
+    for (idx = 0; idx < 1000; idx += 2) {
+        ASSERT_EQUAL(bt_find(tree, &values[idx]) != NULL, idx >= 500);
+    }
+
+    bt_Tree *lt;
+    bt_Tree *ge;
+    bt_split(tree, &values[750], &lt, &ge);
+    ASSERT_NOT_NULL(ge->filter);
+    ASSERT_NOT_NULL(bt_find(ge, &values[750]));
+    ASSERT_NULL(bt_find(lt, &values[750]));
+    ASSERT_TRUE(bt_join(lt, ge));
+    for (idx = 500; idx < 1000; idx += 2) {
+        ASSERT_NOT_NULL(bt_find(lt, &values[idx]));
+    }
+
+    bt_delete(ge);
+    bt_delete(lt);
+    bt_delete(tree);
+}
+
+CTEST(bttest, deferred_balance) {
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    tree->balance = DEFERRED_BALANCE;
+    int values[1000];
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        values[idx] = idx;
+        bt_add(tree, &values[idx]);
+    }
+    for (idx = 0; idx < 1000; idx += 3) {
+        bt_remove(tree, &values[idx]);
+    }
+    ASSERT_FALSE(bt_is_balanced(tree));
+    ASSERT_TRUE(tree->root->dirty);
+
+    // every call stays within a small budget until the tree is balanced, changes in between are
+    // picked up where the walk continues
+    ASSERT_FALSE(bt_balance_step(tree, 1));
+    size_t steps = 0;
+    while (!bt_balance_step(tree, 64)) {
+        if (steps++ == 2) {
+            bt_remove(tree, &values[1]);
+        }
+    }
+    ASSERT_TRUE(steps > 1);
+    ASSERT_TRUE(bt_is_balanced(tree));
+    ASSERT_FALSE(tree->root->dirty);
+    ASSERT_EQUAL(tree->count, 665);
+    for (idx = 0; idx < 1000; idx++) {
+        ASSERT_EQUAL(bt_find(tree, &values[idx]) != NULL, idx % 3 != 0 && idx != 1);
+    }
+
+    bt_delete(tree);
+}
+
+CTEST(bttest, scapegoat_balance) {
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    tree->balance = SCAPEGOAT_BALANCE;
+    int values[1000];
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        values[idx] = idx;
+        bt_add(tree, &values[idx]);
+    }
+    // sorted adds stay within log_3/2(count) + 1 levels
+    ASSERT_TRUE(tree->root->height <= 19);
+
+    for (idx = 0; idx < 900; idx++) {
+        ASSERT_TRUE(bt_remove(tree, &values[idx]));
+    }
+    ASSERT_TRUE(tree->root->height <= 13);
+    ASSERT_EQUAL(tree->count, 100);
+    for (idx = 0; idx < 1000; idx++) {
+        ASSERT_EQUAL(bt_find(tree, &values[idx]) != NULL, idx >= 900);
+    }
+
+    bt_delete(tree);
+}
+
+static bool _is_heap(bt_Tree *tree, bt_Node *node) {
+    if (node == NULL) {
+        return true;
+    }
+    if ((node->left != NULL && _priority(tree, node->left) > _priority(tree, node)) ||
+        (node->right != NULL && _priority(tree, node->right) > _priority(tree, node))) {
+        return false;
+    }
+    return _is_heap(tree, node->left) && _is_heap(tree, node->right);
+}
+
+CTEST(bttest, treap_balance) {
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    tree->balance = TREAP_BALANCE;
+    tree->rng = 42;
+    int values[1000];
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        values[idx] = idx;
+        bt_add(tree, &values[idx]);
+    }
+    ASSERT_TRUE(_is_heap(tree, tree->root));
+    ASSERT_TRUE(tree->root->height < 40);
+
+    bt_Tree *lt;
+    bt_Tree *ge;
+    bt_split(tree, &values[500], &lt, &ge);
+    ASSERT_TRUE(_is_heap(lt, lt->root));
+    ASSERT_TRUE(_is_heap(ge, ge->root));
+    ASSERT_EQUAL(lt->count, 500);
+    ASSERT_EQUAL(ge->count, 500);
+    ASSERT_TRUE(bt_join(lt, ge));
+    ASSERT_TRUE(_is_heap(lt, lt->root));
+
+    for (idx = 0; idx < 1000; idx += 2) {
+        ASSERT_TRUE(bt_remove(lt, &values[idx]));
+    }
+    ASSERT_TRUE(_is_heap(lt, lt->root));
+    for (idx = 0; idx < 1000; idx++) {
+        ASSERT_EQUAL(bt_find(lt, &values[idx]) != NULL, idx % 2 == 1);
+    }
+
+    bt_delete(ge);
+    bt_delete(lt);
+    bt_delete(tree);
+}
+
+CTEST(bttest, compact) {
+    bt_Tree *tree = bt_create_map(_cmp_int, sizeof(int), BT_NO_DELETE);
+    int idx;
+    for (idx = 0; idx < 2000; idx++) {
+        int key = idx * 7919 % 2000;
+        bt_put(tree, &key, NULL, NULL);
+    }
+    for (idx = 0; idx < 2000; idx += 3) {
+        bt_remove(tree, &idx);
+    }
+
+    // steps interleaved with removes relocate every node in order
+    size_t steps = 0;
+    while (!bt_compact_step(tree, 100)) {
+        int removed = (int)steps * 3 + 1;
+        bt_remove(tree, &removed);
+        steps++;
+    }
+    ASSERT_TRUE(steps > 1);
+    bt_Node *node;
+    for (node = bt_first(tree); node != NULL; node = bt_next(node)) {
+        ASSERT_TRUE(node->compacted);
+        ASSERT_TRUE(node->data == (void *)(bt_node_value(node) + 1));
+        uintptr_t region = (uintptr_t)node / BT_COMPACT_REGION;
+        bt_Node *next = bt_next(node);
+        if (next != NULL && (uintptr_t)next / BT_COMPACT_REGION == region) {
+            ASSERT_TRUE(next > node);
+        }
+    }
+    for (idx = 0; idx < 2000; idx++) {
+        bool removed = idx % 3 == 0 || (idx % 3 == 1 && (size_t)idx / 3 < steps);
+        ASSERT_EQUAL(bt_find(tree, &idx) != NULL, !removed);
+    }
+
+    bt_compact(tree);
+    ASSERT_TRUE(bt_first(tree)->compacted);
+    bt_delete(tree);
+}
+
+// allocates as many nodes as the budget passed as ctx allows
+static void *_budget_alloc(size_t size, void *ctx) {
+    size_t *budget = (size_t *)ctx;
+    if (*budget == 0) {
+        return NULL;
+    }
+    *budget -= 1;
+    return malloc(size);
+}
+
+static void _budget_free(void *node, void *ctx) {
+    (void)ctx;
+    free(node);
+}
+
+CTEST(bttest, reserve) {
+    bt_Tree *tree = bt_create_int(BT_NO_DELETE);
+    size_t budget = 100;
+    bt_set_allocator(tree, _budget_alloc, _budget_free, &budget);
+    ASSERT_EQUAL(bt_reserve(tree, 150), BT_ENOMEM);
+    ASSERT_EQUAL(tree->reserved, 100);
+    ASSERT_EQUAL(budget, 0);
+
+    // reserved nodes are used up before the allocator fails
+    int values[101];
+    int idx;
+    for (idx = 0; idx < 100; idx++) {
+        values[idx] = idx;
+        ASSERT_EQUAL(bt_try_add(tree, &values[idx]), BT_OK);
+    }
+    ASSERT_EQUAL(bt_try_add(tree, &values[50]), BT_EXISTS);
+    values[100] = 100;
+    ASSERT_EQUAL(bt_try_add(tree, &values[100]), BT_ENOMEM);
+    ASSERT_FALSE(bt_add(tree, &values[100]));
+    bt_Node *node;
+    ASSERT_EQUAL(bt_upsert(tree, &values[100], &node), BT_ENOMEM);
+    ASSERT_NULL(node);
+    ASSERT_EQUAL(bt_upsert(tree, &values[50], &node), BT_EXISTS);
+    ASSERT_TRUE(node->data == &values[50]);
+    ASSERT_EQUAL(tree->count, 100);
+    ASSERT_NULL(bt_find(tree, &values[100]));
+    ASSERT_TRUE(bt_is_balanced(tree));
+
+    bt_Node **traversal = NULL;
+    ASSERT_EQUAL(bt_traverse(tree, IN_ORDER, &traversal), BT_OK);
+    ASSERT_EQUAL(*(int *)traversal[99]->data, 99);
+    free(traversal);
+
+    budget = 10;
+    ASSERT_EQUAL(bt_reserve(tree, 10), BT_OK);
+    ASSERT_EQUAL(bt_upsert(tree, &values[100], &node), BT_OK);
+    ASSERT_TRUE(node->data == &values[100]);
+    ASSERT_EQUAL(tree->count, 101);
+    bt_delete(tree);
+}
+
+CTEST(bttest, small) {
+    bt_Tree *tree = bt_create_map(_cmp_int, sizeof(int), BT_NO_DELETE);
+    tree->small_max = 16;
+    int idx;
+    for (idx = 0; idx < 16; idx++) {
+        int key = idx * 7 % 16;
+        ASSERT_TRUE(bt_put(tree, &key, NULL, NULL));
+    }
+
+    // the nodes are kept sorted in one block
+    ASSERT_NOT_NULL(tree->small);
+    size_t stride = (size_t)((char *)bt_next(bt_first(tree)) - (char *)bt_first(tree));
+    bt_Node *node;
+    for (idx = 0, node = bt_first(tree); node != NULL; idx++, node = bt_next(node)) {
+        ASSERT_TRUE((char *)node == (char *)tree->small + idx * stride);
+        ASSERT_EQUAL(*(int *)node->data, idx);
+    }
+    ASSERT_TRUE(bt_is_balanced(tree));
+
+    // growing beyond small_max allocates the nodes one by one, shrinking to half returns to a block
+    int key = 16;
+    ASSERT_TRUE(bt_put(tree, &key, NULL, NULL));
+    ASSERT_NULL(tree->small);
+    for (idx = 16; idx >= 8; idx--) {
+        ASSERT_TRUE(bt_remove(tree, &idx));
+    }
+    ASSERT_NOT_NULL(tree->small);
+    ASSERT_EQUAL(tree->count, 8);
+    for (idx = 0; idx < 17; idx++) {
+        ASSERT_EQUAL(bt_find(tree, &idx) != NULL, idx < 8);
+    }
+
+    for (idx = 0; idx < 8; idx++) {
+        ASSERT_TRUE(bt_remove(tree, &idx));
+    }
+    ASSERT_NULL(tree->small);
+    ASSERT_NULL(tree->root);
+
+    // the block is allocated like the nodes and reserving moves the nodes out of it
+    size_t budget = 1;
+    ASSERT_TRUE(bt_set_allocator(tree, _budget_alloc, _budget_free, &budget));
+    ASSERT_TRUE(bt_put(tree, &key, NULL, NULL));
+    ASSERT_NOT_NULL(tree->small);
+    ASSERT_EQUAL(budget, 0);
+    ASSERT_FALSE(bt_set_allocator(tree, NULL, NULL, NULL));
+    budget = 3;
+    ASSERT_EQUAL(bt_reserve(tree, 2), BT_OK);
+    ASSERT_NULL(tree->small);
+    ASSERT_EQUAL(budget, 0);
+    for (idx = 0; idx < 2; idx++) {
+        ASSERT_TRUE(bt_put(tree, &idx, NULL, NULL));
+    }
+    ASSERT_NULL(tree->small);
+    ASSERT_EQUAL(tree->count, 3);
+    bt_delete(tree);
+}
+
+CTEST(bttest, finger) {
+    bt_Tree *tree = bt_create(_cmp_int_counted, BT_NO_DELETE);
+    tree->finger = true;
+    static int values[20000];
+    int idx;
+    for (idx = 0; idx < 20000; idx++) {
+        values[idx] = idx;
+    }
+    // nearly sorted, every value is at most three positions away from its place
+    srand(7);
+    for (idx = 0; idx + 3 < 20000; idx += 4) {
+        int other = idx + 1 + rand() % 3;
+        int swap = values[idx];
+        values[idx] = values[other];
+        values[other] = swap;
+    }
+
+    compares = 0;
+    for (idx = 0; idx < 20000; idx++) {
+        ASSERT_TRUE(bt_add(tree, &values[idx]));
+    }
+    // a descent from the root would take about 14 compares per add
+    ASSERT_TRUE(compares < 20000 * 6);
+    ASSERT_TRUE(bt_is_balanced(tree));
+    ASSERT_FALSE(bt_add(tree, &values[100]));
+
+    for (idx = 0; idx < 20000; idx += 100) {
+        ASSERT_TRUE(bt_remove(tree, &values[idx]));
+    }
+    for (idx = 0; idx < 20000; idx += 100) {
+        ASSERT_TRUE(bt_add(tree, &values[idx]));
+    }
+    ASSERT_EQUAL(tree->count, 20000);
+    bt_Node *node;
+    for (idx = 0, node = bt_first(tree); node != NULL; idx++, node = bt_next(node)) {
+        ASSERT_EQUAL(*(int *)node->data, idx);
+    }
+    bt_delete(tree);
+}
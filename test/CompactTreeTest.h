@@ -0,0 +1,77 @@
+#include "CompactTree.h"
+#include <stdlib.h>
+
+#include "ctest.h"
+
+static int _ct_height(ct_Tree *tree, uint32_t node) {
+    if (node == CT_NIL) {
+        return 0;
+    }
+    int left = _ct_height(tree, _ct_left(tree, node));
+    int right = _ct_height(tree, _ct_right(tree, node));
+    return 1 + (left > right ? left : right);
+}
+
+CTEST(cttest, node_size) { ASSERT_EQUAL(sizeof(ct_Node), 16); }
+
+CTEST(cttest, add_remove) {
+    ct_Tree *tree = ct_create(_cmp_int, CT_TRIVIAL_DELETE);
+    ASSERT_TRUE(ct_reserve(tree, 1000));
+    ASSERT_FALSE(ct_reserve(tree, CT_MAX_NODES));
+
+    for (int idx = 0; idx < 1000; idx++) {
+        int *val = (int *)malloc(sizeof(int));
+        *val = idx * 7919 % 1000;
+        ASSERT_TRUE(ct_add(tree, val));
+    }
+    int dup = 500;
+    ASSERT_FALSE(ct_add(tree, &dup));
+    ASSERT_EQUAL(tree->count, 1000);
+    // AVL bound for 1000 nodes
+    ASSERT_TRUE(_ct_height(tree, tree->root) <= 14);
+
+    for (int idx = 0; idx < 1000; idx += 2) {
+        int *found = (int *)ct_find(tree, &idx);
+        ASSERT_NOT_NULL(found);
+        ASSERT_TRUE(ct_remove(tree, &idx));
+        free(found);
+    }
+    ASSERT_FALSE(ct_remove(tree, &dup));
+    ASSERT_EQUAL(tree->count, 500);
+
+    // removed slots are reused
+    uint32_t capacity = tree->capacity;
+    for (int idx = 0; idx < 500; idx++) {
+        int *val = (int *)malloc(sizeof(int));
+        *val = 1000 + idx;
+        ASSERT_TRUE(ct_add(tree, val));
+    }
+    ASSERT_EQUAL(tree->capacity, capacity);
+
+    void **list;
+    ct_traverse(tree, &list);
+    for (size_t idx = 1; idx < tree->count; idx++) {
+        ASSERT_TRUE(*(int *)list[idx - 1] < *(int *)list[idx]);
+    }
+    free(list);
+
+    ct_delete(tree);
+}
+
+static int _ct_deleted;
+
+static void _ct_count_delete(void *data) { _ct_deleted += *(int *)data; }
+
+CTEST(cttest, delete_live_only) {
+    ct_Tree *tree = ct_create(_cmp_int, _ct_count_delete);
+    int values[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    for (int idx = 0; idx < 8; idx++) {
+        ASSERT_TRUE(ct_add(tree, &values[idx]));
+    }
+    // removed slots keep stale data, which must not be passed to delete
+    ASSERT_TRUE(ct_remove(tree, &values[0]));
+    ASSERT_TRUE(ct_remove(tree, &values[7]));
+    _ct_deleted = 0;
+    ct_delete(tree);
+    ASSERT_EQUAL(_ct_deleted, 2 + 3 + 4 + 5 + 6 + 7);
+}
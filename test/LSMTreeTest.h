@@ -0,0 +1,82 @@
+#include "LSMTree.h"
+#include <stdlib.h>
+
+#include "ctest.h"
+
+static uint64_t _hash_int(void *data) { return (uint64_t)(*(int *)data); }
+
+static int _lsm_sum(void *data, void *ctx) {
+    *(long *)ctx += *(int *)data;
+    return 0;
+}
+
+CTEST(lsmtest, add_remove_find) {
+    lsm_Tree *tree = lsm_create(_cmp_int, _hash_int, BT_TRIVIAL_DELETE, 64);
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        int *val = (int *)malloc(sizeof(int));
+        *val = idx * 7919 % 1000;
+        ASSERT_TRUE(lsm_add(tree, val));
+    }
+    ASSERT_TRUE(tree->run_count > 1);
+    ASSERT_TRUE(tree->run_count <= LSM_MAX_RUNS);
+    ASSERT_NOT_NULL(tree->runs[0].bloom);
+
+    // removes shadow the versions in older runs
+    for (idx = 0; idx < 1000; idx += 2) {
+        int *val = (int *)malloc(sizeof(int));
+        *val = idx;
+        lsm_remove(tree, val);
+    }
+    // a newer version replaces an older one
+    int *replaced = (int *)malloc(sizeof(int));
+    *replaced = 1;
+    lsm_add(tree, replaced);
+
+    for (idx = 0; idx < 1000; idx++) {
+        int *found = (int *)lsm_find(tree, &idx);
+        if (idx % 2 == 0) {
+            ASSERT_NULL(found);
+        } else {
+            ASSERT_NOT_NULL(found);
+            ASSERT_EQUAL(*found, idx);
+        }
+    }
+    ASSERT_TRUE(lsm_find(tree, &idx) == NULL);
+    ASSERT_TRUE(lsm_find(tree, replaced) == replaced);
+
+    long sum = 0;
+    ASSERT_EQUAL(lsm_foreach(tree, _lsm_sum, &sum), 0);
+    ASSERT_EQUAL(sum, 250000);
+
+    size_t runs = tree->run_count;
+    lsm_freeze(tree);
+    while (lsm_merge_step(tree)) {
+    }
+    ASSERT_TRUE(tree->run_count < runs);
+    ASSERT_EQUAL(tree->memtable->count, 0);
+
+    sum = 0;
+    lsm_foreach(tree, _lsm_sum, &sum);
+    ASSERT_EQUAL(sum, 250000);
+    ASSERT_TRUE(lsm_find(tree, replaced) == replaced);
+
+    lsm_delete(tree);
+}
+
+CTEST(lsmtest, out_of_memory) {
+    lsm_Tree *tree = lsm_create(_cmp_int, _hash_int, BT_NO_DELETE, 64);
+    size_t budget = 1;
+    bt_set_allocator(tree->memtable, _budget_alloc, _budget_free, &budget);
+
+    int values[2] = {1, 2};
+    ASSERT_TRUE(lsm_add(tree, &values[0]));
+    // replacing a version takes no node, a new one fails and is not owned by the tree
+    ASSERT_TRUE(lsm_remove(tree, &values[0]));
+    ASSERT_FALSE(lsm_add(tree, &values[1]));
+    ASSERT_EQUAL(tree->memtable->count, 1);
+    ASSERT_NULL(lsm_find(tree, &values[0]));
+    ASSERT_NULL(lsm_find(tree, &values[1]));
+
+    lsm_delete(tree);
+}
@@ -0,0 +1,88 @@
+#include "ShardedTree.h"
+#include <stdlib.h>
+
+#include "ctest.h"
+
+static int _sh_check_order(void *data, void *ctx) {
+    int *last = (int *)ctx;
+    if (*(int *)data <= *last) {
+        return -1;
+    }
+    *last = *(int *)data;
+    return 0;
+}
+
+static int *_sh_int(int value) {
+    int *val = (int *)malloc(sizeof(int));
+    *val = value;
+    return val;
+}
+
+CTEST(shtest, add_remove_find) {
+    sh_Tree *tree = sh_create(_cmp_int, BT_TRIVIAL_DELETE, 64);
+    int idx;
+    for (idx = 0; idx < 1000; idx++) {
+        ASSERT_TRUE(sh_add(tree, _sh_int(idx * 7919 % 1000)));
+    }
+    ASSERT_TRUE(tree->shard_count > 1000 / 64);
+    ASSERT_EQUAL(sh_count(tree), 1000);
+    int probe = 500;
+    ASSERT_FALSE(sh_add(tree, &probe));
+
+    // split keys stay valid for routing after their data was removed
+    for (idx = 0; idx < 1000; idx += 2) {
+        ASSERT_TRUE(sh_remove(tree, &idx));
+    }
+    for (idx = 0; idx < 1000; idx++) {
+        ASSERT_EQUAL(sh_find(tree, &idx) != NULL, idx % 2 == 1);
+    }
+    for (idx = 0; idx < 1000; idx += 2) {
+        ASSERT_TRUE(sh_add(tree, _sh_int(idx)));
+    }
+    ASSERT_EQUAL(sh_count(tree), 1000);
+
+    int last = -1;
+    ASSERT_EQUAL(sh_foreach(tree, _sh_check_order, &last), 0);
+    ASSERT_EQUAL(last, 999);
+    sh_delete(tree);
+}
+
+typedef struct {
+    sh_Tree *tree;
+    int first;
+} ShWorker;
+
+static void *_sh_work(void *ctx) {
+    ShWorker *worker = (ShWorker *)ctx;
+    int idx;
+    for (idx = worker->first; idx < worker->first + 1000; idx++) {
+        sh_add(worker->tree, _sh_int(idx));
+    }
+    for (idx = worker->first; idx < worker->first + 1000; idx += 2) {
+        sh_remove(worker->tree, &idx);
+    }
+    return NULL;
+}
+
+CTEST(shtest, concurrent) {
+    sh_Tree *tree = sh_create(_cmp_int, BT_TRIVIAL_DELETE, 128);
+    pthread_t threads[4];
+    ShWorker workers[4];
+    int idx;
+    for (idx = 0; idx < 4; idx++) {
+        workers[idx].tree = tree;
+        workers[idx].first = idx * 1000;
+        pthread_create(&threads[idx], NULL, _sh_work, &workers[idx]);
+    }
+    for (idx = 0; idx < 4; idx++) {
+        pthread_join(threads[idx], NULL);
+    }
+
+    ASSERT_EQUAL(sh_count(tree), 2000);
+    for (idx = 0; idx < 4000; idx++) {
+        ASSERT_EQUAL(sh_find(tree, &idx) != NULL, idx % 2 == 1);
+    }
+    int last = -1;
+    ASSERT_EQUAL(sh_foreach(tree, _sh_check_order, &last), 0);
+    sh_delete(tree);
+}